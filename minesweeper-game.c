@@ -1,35 +1,118 @@
+/* affinity of threads */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 
 #include <err.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 
-#ifdef __OpenBSD__
-#define srandom srandom_deterministic
-#endif
-
 #define USAGE_SMALL \
     "usage: %s [-" \
     "h" \
+    "a" \
+    "i" \
+    "A" \
+    "B" \
+    "D" \
+    "F" \
+    "N" \
+    "O" \
+    "P" \
     "S" \
+    "T" \
+    "W" \
     "]" \
+    " [-C corpus | -Q corpus | -R field | -G socket]" \
+    " [-L scores]" \
+    " [-M most]" \
+    " [-V socket]" \
+    " [-d latency]" \
+    " [-j jobs]" \
+    " [-k level]" \
+    " [-l socket]" \
+    " [-n count]" \
+    " [-p socket]" \
+    " [-q rate]" \
+    " [-r metric=min-max]" \
     " [-s seed]" \
+    " [-t topology]" \
     " [-m mines]" \
-    " [width height]" \
+    " [width height [depth]]" \
     "\n"
 #define USAGE_DESCRIPTION \
     "  -h            show this help menu\n" \
+    "  -a            pin threads to CPUs in turn\n" \
+    "  -i            start count sessions of -l nobody plays\n" \
+    "                and show the memory they take\n" \
+    "  -A            show all seeds found by -F, not only the lowest one\n" \
+    "  -B            play count games by the solver and show statistics\n" \
+    "  -D            make -G do what numbers prove instead of random opens\n" \
+    "  -F            find seeds of fields matching every -r and -N\n" \
+    "  -N            find only fields solvable without guessing from 1x1\n" \
+    "  -O            open count random cells of one field from jobs threads\n" \
+    "                and show how often they waited for each other\n" \
+    "  -P            place mines by shuffling cells, needed for windows in -F\n" \
     "  -S            show used seed\n" \
+    "  -T            wrap the field around into a torus, at least 3x3\n" \
+    "  -W            time the game and show the time of every move at its end\n" \
+    "  -C corpus     generate boards with their metrics into corpus file\n" \
+    "  -Q corpus     print seeds of boards from corpus file matching -r\n" \
+    "  -R field      find seeds of the field shown by the game in file\n" \
+    "  -G socket     play count sessions at once with the server of -l\n" \
+    "                on socket and show moves a second and their latency\n" \
+    "  -L scores     time the game and keep the best won ones in scores file,\n" \
+    "                also the ones of the solver with -B\n" \
+    "  -M most       most mines one cell can hold, default is 1\n" \
+    "  -V socket     show the field of the game to every connection to Unix socket\n" \
+    "  -d latency    latency in us moves of -G should be within, default is 1000\n" \
+    "  -j jobs       amount of threads to use, default is amount of CPUs\n" \
+    "  -k level      generic, sse2, avx2 or avx512 kernels to use,\n" \
+    "                default is the best one the CPU has\n" \
+    "  -l socket     serve a game to every connection to Unix socket\n" \
+    "  -n count      amount of boards, games, cells, seeds or sessions,\n" \
+    "                default is 1000000, all seeds for -F, 10000 for -i\n" \
+    "                or 1000 for -G\n" \
+    "  -p socket     serve counters of games in Prometheus format on Unix socket\n" \
+    "  -q rate       most moves a second of a session of -l or -G, 0 for any,\n" \
+    "                default is 100\n" \
+    "  -r metric=min-max\n" \
+    "                range of 3bv, openings or click to query or find,\n" \
+    "                default is any\n" \
     "  -s seed       set user-defined seed for mines generation\n" \
-    "  -m mines      amount of mines to place, default is width*height/10\n" \
+    "                or the first seed for -B, -C and -F, default for it is 0\n" \
+    "  -t topology   square, cross, hex or knight cells touching a cell,\n" \
+    "                default is square\n" \
+    "  -m mines      amount of mines to place, default is width*height*depth/10\n" \
     "  width height  size of field, default is 10 by 10\n" \
+    "  depth         amount of layers of a 3D field, default is 1\n" \
 
 void usage(int full)
 {
@@ -46,437 +129,5423 @@ void usage(int full)
 #undef USAGE_SMALL
 #undef USAGE_DESCRIPTION
 
-enum Field_Cell_Status
-{
-    Field_Cell_Status_HIDDEN,
-    Field_Cell_Status_OPENED,
-    Field_Cell_Status_FLAGGED,
-};
+/*
+ * Same additive feedback generator as random(3) of glibc, but with the
+ * state kept by the caller, so boards can be generated from many threads
+ * and the same seed gives the same board on every system.
+ */
+#define Random_DEGREE 31
+#define Random_SEPARATION 3
 
-struct Field_Cell
+struct Random
 {
-    unsigned char status : 2;
-    unsigned char is_mine : 1;
-    unsigned char is_selected : 1;
-    unsigned char mines_near : 4;
+    uint32_t state[Random_DEGREE];
+    unsigned front, rear;
 };
 
-struct Field
+long Random_next(struct Random *random)
 {
-    unsigned width, height;
-    struct Field_Cell *field;
-};
+    uint32_t result;
+
+    result = random->state[random->front] += random->state[random->rear];
+    if (++random->front == Random_DEGREE)
+        random->front = 0;
+    if (++random->rear == Random_DEGREE)
+        random->rear = 0;
 
-void Field_generate(struct Field *field, unsigned mines)
+    return result >> 1;
+}
+
+void Random_words(uint32_t words[Random_DEGREE], unsigned seed)
 {
-    unsigned x, y, xr, yr;
-    struct Field_Cell *cur;
+    int32_t word;
+
+    if (seed == 0)
+        seed = 1;
 
-    while (mines > 0)
+    words[0] = word = seed;
+    for (int i = 1; i < Random_DEGREE; ++i)
     {
-        x = random() % field->width;
-        y = random() % field->height;
+        /* word = 16807 * word % 2147483647 without overflowing */
+        long hi = word / 127773, lo = word % 127773;
 
-        cur = field->field + x + y * field->width;
-        if (cur->is_mine)
-            continue;
-        cur->is_mine = 1;
+        word = 16807 * lo - 2836 * hi;
+        if (word < 0)
+            word += 2147483647;
+        words[i] = word;
+    }
+}
 
-        for (int j = -1; j <= 1; ++j)
-        {
-            for (int i = -1; i <= 1; ++i)
-            {
-                xr = x + i;
-                yr = y + j;
+void Random_seed(struct Random *random, unsigned seed)
+{
+    Random_words(random->state, seed);
+    random->front = Random_SEPARATION;
+    random->rear = 0;
 
-                cur = field->field + xr + yr * field->width;
-                if (xr < 0 || yr < 0 || xr >= field->width || yr >= field->height)
-                    continue;
-                ++cur->mines_near;
-            }
-        }
-        --mines;
+    for (int i = 0; i < Random_DEGREE * 10; ++i)
+        Random_next(random);
+}
+
+/*
+ * Every output is a sum of the seeded words with constant coefficients,
+ * so the first few can be computed without the discarded ones.
+ */
+#define Random_EARLY 8
+
+struct Random_Early
+{
+    uint32_t coefficients[Random_EARLY][Random_DEGREE];
+};
+
+void Random_earlyInit(struct Random_Early *early)
+{
+    uint32_t state[Random_DEGREE][Random_DEGREE] = {0};
+    unsigned front = Random_SEPARATION, rear = 0;
+
+    for (int i = 0; i < Random_DEGREE; ++i)
+        state[i][i] = 1;
+
+    for (int step = 0; step < Random_DEGREE * 10 + Random_EARLY; ++step)
+    {
+        for (int i = 0; i < Random_DEGREE; ++i)
+            state[front][i] += state[rear][i];
+        if (step >= Random_DEGREE * 10)
+            memcpy(early->coefficients[step - Random_DEGREE * 10], state[front], sizeof(state[front]));
+        if (++front == Random_DEGREE)
+            front = 0;
+        if (++rear == Random_DEGREE)
+            rear = 0;
     }
 }
 
-void Field_open(struct Field *field, unsigned x, unsigned y)
+long Random_early(const struct Random_Early *early, const uint32_t words[Random_DEGREE], unsigned n)
 {
-    if (x < 0 || y < 0 || x >= field->width || y >= field->height)
-        return;
+    uint32_t result = 0;
 
-    if (field->field[x + y * field->width].status != Field_Cell_Status_OPENED)
-        field->field[x + y * field->width].status = Field_Cell_Status_OPENED;
-    else
-        return;
+    for (int i = 0; i < Random_DEGREE; ++i)
+        result += early->coefficients[n][i] * words[i];
 
-    if (field->field[x + y * field->width].mines_near != 0)
-        return;
+    return result >> 1;
+}
+
+/*
+ * Keyed permutation of [0, size), a Feistel network on the smallest even
+ * amount of bits covering size with cycle walking. Both directions cost
+ * the same, so the mine placed n-th and the place of a mine are known
+ * without generating anything else.
+ */
+#define Shuffle_ROUNDS 6
+
+struct Shuffle
+{
+    unsigned size, half;
+    uint32_t keys[Shuffle_ROUNDS];
+};
 
-    for (int j = -1; j <= 1; ++j)
-        for (int i = -1; i <= 1; ++i)
-            Field_open(field, x + i, y + j);
+uint32_t Shuffle_mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
 }
 
-int Field_isWin(struct Field *field)
+void Shuffle_init(struct Shuffle *shuffle, unsigned size, unsigned seed)
 {
-    int closed = 0, mines = 0;
-    for (unsigned i = 0; i < field->width * field->height; ++i)
-    {
-        if (field->field[i].is_mine && field->field[i].status == Field_Cell_Status_OPENED)
-            return -1;
-        closed += field->field[i].status != Field_Cell_Status_OPENED;
-        mines += field->field[i].is_mine;
-    }
-    return closed == mines;
+    shuffle->size = size;
+    for (shuffle->half = 0; (uint64_t)1 << 2 * shuffle->half < size; ++shuffle->half);
+    for (int i = 0; i < Shuffle_ROUNDS; ++i)
+        shuffle->keys[i] = Shuffle_mix(seed + 0x9e3779b9 * (i + 1));
 }
 
-void Field_print(struct Field *field)
+unsigned Shuffle_forward(const struct Shuffle *shuffle, unsigned i)
 {
-    for (unsigned y = 0; y < field->height; ++y)
+    uint32_t mask = ((uint32_t)1 << shuffle->half) - 1, l, r, t;
+
+    do
     {
-        for (unsigned x = 0; x < field->width; ++x)
+        l = i >> shuffle->half;
+        r = i & mask;
+        for (int k = 0; k < Shuffle_ROUNDS; ++k)
         {
-            struct Field_Cell c = field->field[x + y * field->width];
-            switch (c.status)
-            {
-            case Field_Cell_Status_HIDDEN:
-            {
-                printf(c.is_selected ? "X]" : "[]");
-            } break;
-            case Field_Cell_Status_FLAGGED:
-            {
-                printf(c.is_selected ? "X?" : "??");
-            } break;
-            case Field_Cell_Status_OPENED:
-            {
-                if (c.is_mine)
-                    printf(c.is_selected ? "X#" : "##");
-                else
-                    printf(c.is_selected ? "X%d" : " %d", c.mines_near);
-            } break;
-            }
+            t = r;
+            r = l ^ (Shuffle_mix(r ^ shuffle->keys[k]) & mask);
+            l = t;
         }
-        putchar('\n');
-    }
+        i = l << shuffle->half | r;
+    } while (i >= shuffle->size);
+
+    return i;
 }
 
-const char *const Player_Move_Action_CHARS =
-    "@"
-    "!"
-    "j"
-    "?"
-    "h"
-    "#"
-    "l"
-    "k"
-;
+unsigned Shuffle_backward(const struct Shuffle *shuffle, unsigned i)
+{
+    uint32_t mask = ((uint32_t)1 << shuffle->half) - 1, l, r, t;
 
-enum Player_Move_Action
+    do
+    {
+        l = i >> shuffle->half;
+        r = i & mask;
+        for (int k = Shuffle_ROUNDS - 1; k >= 0; --k)
+        {
+            t = l;
+            l = r ^ (Shuffle_mix(l ^ shuffle->keys[k]) & mask);
+            r = t;
+        }
+        i = l << shuffle->half | r;
+    } while (i >= shuffle->size);
+
+    return i;
+}
+
+enum Field_Cell_Status
 {
-    Player_Move_Action_CLICK_OPEN,
-    Player_Move_Action_CLICK_FLAG,
-    Player_Move_Action_DOWN,
-    Player_Move_Action_FLAG,
-    Player_Move_Action_LEFT,
-    Player_Move_Action_OPEN,
-    Player_Move_Action_RIGHT,
-    Player_Move_Action_UP,
+    Field_Cell_Status_HIDDEN,
+    Field_Cell_Status_OPENED,
+    Field_Cell_Status_FLAGGED,
+    /* known to be safe, seen only in solver's branches */
+    Field_Cell_Status_SAFE,
 };
 
-struct Player_Move
+/*
+ * Bits of mines_near, set at build time. 4 bits count up to 15, which is
+ * enough for every flat field and keep a cell in a byte; a cube has 26
+ * cells around and itself, so 3D fields need at least 5.
+ */
+#ifndef Field_COUNT_BITS
+#define Field_COUNT_BITS 4
+#endif
+
+/* Bits of is_mine, which is how many mines are in the cell */
+#ifndef Field_MINE_BITS
+#define Field_MINE_BITS 1
+#endif
+
+#define Field_BITS (3 + Field_MINE_BITS + Field_COUNT_BITS)
+
+#if Field_COUNT_BITS < 4 || Field_MINE_BITS < 1 || Field_BITS > 32
+#error "Field_COUNT_BITS must be at least 4, Field_MINE_BITS at least 1 and a cell at most 32 bits"
+#elif Field_BITS <= 8
+typedef unsigned char Field_Word;
+#elif Field_BITS <= 16
+typedef unsigned short Field_Word;
+#else
+typedef unsigned Field_Word;
+#endif
+
+#define Field_COUNT_MAX ((1u << Field_COUNT_BITS) - 1)
+#define Field_MINE_MAX ((1u << Field_MINE_BITS) - 1)
+
+struct Field_Cell
 {
-    int x, y;
-    enum Player_Move_Action action;
+    Field_Word status : 2;
+    Field_Word is_mine : Field_MINE_BITS;
+    Field_Word is_selected : 1;
+    Field_Word mines_near : Field_COUNT_BITS;
 };
 
-struct Player_Move Player_process(void)
+/* Cells tracked by one byte of dirty */
+#define Field_CHUNK 64
+
+/*
+ * Cells touching a cell, and the cell itself, as x, y and z offsets. Flat
+ * fields use only the ones with no z. Hex fields have every odd row
+ * shifted by half a cell to the right, so their odd rows have offsets of
+ * their own.
+ */
+#define Field_TOUCHING 27
+
+enum Field_Topology
 {
-    enum Player_Move_Action action;
-    int x = 0, y = 0, ch;
-    char *actionp;
+    Field_Topology_SQUARE,
+    Field_Topology_CROSS,
+    Field_Topology_HEX,
+    Field_Topology_KNIGHT,
+    Field_Topology_COUNT,
+};
 
-    while ((ch = getchar()) >= 0 && !(actionp = strchr(Player_Move_Action_CHARS, ch)));
-    if (ch < 0)
-        goto eof;
-    action = actionp - Player_Move_Action_CHARS;
+struct Field_Topology_Offsets
+{
+    const char *name;
+    unsigned reach, parity, count;
+    signed char x[2][Field_TOUCHING], y[Field_TOUCHING], z[Field_TOUCHING];
+};
 
-    switch (action)
-    case Player_Move_Action_FLAG:
-    case Player_Move_Action_OPEN:
+const struct Field_Topology_Offsets Field_Topology_OFFSETS[Field_Topology_COUNT] = {
     {
+        "square", 1, 0, 27,
+        {{
+            -1, 0, 1, -1, 0, 1, -1, 0, 1,
+            -1, 0, 1, -1, 0, 1, -1, 0, 1,
+            -1, 0, 1, -1, 0, 1, -1, 0, 1,
+        }},
         {
-        while ((ch = getchar()) >= 0 && ch != 'x')
-        {
-            if (!isdigit(ch))
-                continue;
-            x *= 10;
-            x += ch - '0';
-        }
-        x -= 1;
-
-        while ((ch = getchar()) >= 0 && ch != ';')
+            -1, -1, -1, 0, 0, 0, 1, 1, 1,
+            -1, -1, -1, 0, 0, 0, 1, 1, 1,
+            -1, -1, -1, 0, 0, 0, 1, 1, 1,
+        },
         {
-            if (!isdigit(ch))
-                continue;
-            y *= 10;
-            y += ch - '0';
-        }
-        y -= 1;
-    } break;
-    case Player_Move_Action_UP:
-    case Player_Move_Action_DOWN:
+            -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            0, 0, 0, 0, 0, 0, 0, 0, 0,
+            1, 1, 1, 1, 1, 1, 1, 1, 1,
+        },
+    },
     {
-        while ((ch = getchar()) >= 0 && ch != ';')
-        {
-            if (!isdigit(ch))
-                continue;
-            y *= 10;
-            y += ch - '0';
-        }
-    } break;
-    case Player_Move_Action_LEFT:
-    case Player_Move_Action_RIGHT:
+        "cross", 1, 0, 7,
+        {{0, 0, -1, 0, 1, 0, 0}},
+        {0, -1, 0, 0, 0, 1, 0},
+        {-1, 0, 0, 0, 0, 0, 1},
+    },
+    {
+        "hex", 1, 1, 9,
+        {{0, -1, 0, -1, 0, 1, -1, 0, 0}, {0, 0, 1, -1, 0, 1, 0, 1, 0}},
+        {0, -1, -1, 0, 0, 0, 1, 1, 0},
+        {-1, 0, 0, 0, 0, 0, 0, 0, 1},
+    },
+    /* flat only */
+    {
+        "knight", 2, 0, 9,
+        {{-1, 1, -2, 2, 0, -2, 2, -1, 1}},
+        {-2, -2, -1, -1, 0, 1, 1, 2, 2},
+    },
+};
+
+/*
+ * Offsets of the topology for every way a cell can be near the edges, so
+ * neighbours are found without bounds checks, and on a torus offsets at
+ * an edge jump to the other one. A line is how far a cell is from both
+ * ends of its row, column or pillar, up to the reach of the topology.
+ */
+#define Field_NEARS 128
+
+struct Field_Near
+{
+    unsigned count;
+    int x[Field_TOUCHING], y[Field_TOUCHING], z[Field_TOUCHING], offset[Field_TOUCHING];
+};
+
+struct Field
+{
+    unsigned width, height, depth;
+    struct Field_Cell *field;
+    unsigned char *dirty;
+    int wrap;
+    /* most mines a cell can hold */
+    unsigned most;
+    /* odd while the only writer changes cells, see Field_snapshot */
+    _Atomic unsigned sequence;
+    const struct Field_Topology_Offsets *topology;
+    unsigned reach, lines, layers, parity;
+    struct Field_Near near[Field_NEARS];
+};
+
+unsigned Field_cells(const struct Field *field)
+{
+    return field->width * field->height * field->depth;
+}
+
+unsigned Field_line(unsigned i, unsigned size, unsigned reach)
+{
+    unsigned after = size - 1 - i;
+
+    return (i < reach ? i : reach) * (reach + 1) + (after < reach ? after : reach);
+}
+
+int Field_edge(int *offset, unsigned before, unsigned after, unsigned size, int wrap)
+{
+    if (*offset < 0 && (unsigned)-*offset > before)
+        *offset += size;
+    else if (*offset > 0 && (unsigned)*offset > after)
+        *offset -= size;
+    else
+        return 1;
+    return wrap;
+}
+
+/*
+ * Width, height and depth must be set. A torus must be at least
+ * 2 * reach + 1 cells along every side that is not flat, and a hex one
+ * must have an even height.
+ */
+void Field_init(struct Field *field, int wrap, enum Field_Topology topology, unsigned most)
+{
+    const struct Field_Topology_Offsets *offsets = Field_Topology_OFFSETS + topology;
+    unsigned reach = offsets->reach, deep = field->depth > 1 ? reach : 0;
+    unsigned candidates[Field_TOUCHING], count = 0;
+    struct Field_Near *near = field->near;
+
+    field->wrap = wrap;
+    field->most = most;
+    field->topology = offsets;
+    field->reach = reach;
+    field->lines = (reach + 1) * (reach + 1);
+    field->layers = (deep + 1) * (deep + 1);
+    field->parity = offsets->parity;
+
+    for (unsigned k = 0; k < offsets->count; ++k)
+        if (deep || !offsets->z[k])
+            candidates[count++] = k;
+
+    /* in the order of Field_near */
+    for (unsigned parity = 0; parity <= offsets->parity; ++parity)
+    for (unsigned front = 0; front <= deep; ++front)
+    for (unsigned back = 0; back <= deep; ++back)
+    for (unsigned top = 0; top <= reach; ++top)
+    for (unsigned bottom = 0; bottom <= reach; ++bottom)
+    for (unsigned left = 0; left <= reach; ++left)
+    for (unsigned right = 0; right <= reach; ++right, ++near)
     {
-        while ((ch = getchar()) >= 0 && ch != ';')
+        near->count = 0;
+        for (unsigned c = 0; c < count; ++c)
         {
-            if (!isdigit(ch))
+            unsigned k = candidates[c];
+
+            near->x[near->count] = offsets->x[parity][k];
+            near->y[near->count] = offsets->y[k];
+            near->z[near->count] = offsets->z[k];
+            if (!Field_edge(near->x + near->count, left, right, field->width, wrap)
+                || !Field_edge(near->y + near->count, top, bottom, field->height, wrap)
+                || !Field_edge(near->z + near->count, front, back, field->depth, wrap))
                 continue;
-            x *= 10;
-            x += ch - '0';
+            near->offset[near->count] = near->x[near->count]
+                + (int)field->width * (near->y[near->count] + (int)field->height * near->z[near->count]);
+            ++near->count;
         }
-    } break;
     }
+}
 
-    if (ch < 0)
-    {
-eof:
-        if (errno)
-            warn("cannot read input");
-        exit(errno);
-    }
+/* The most cells a cell of the field is counted from */
+unsigned Field_around(const struct Field *field)
+{
+    unsigned nears = field->lines * field->lines * field->layers * (field->parity + 1), most = 0;
 
-    return (struct Player_Move){.x=x, .y=y, .action=action};
+    for (unsigned i = 0; i < nears; ++i)
+        if (field->near[i].count > most)
+            most = field->near[i].count;
+    return most;
 }
 
-int main(int argc, char **argv)
+const struct Field_Near *Field_near(const struct Field *field, unsigned x, unsigned y, unsigned z)
 {
-    struct Field field = {10, 10, 0};
-    int selected_x, selected_y;
-    unsigned seed, mines;
-    int is_mines_set = 0, is_seed_set = 0, ch;
-    int show_seed = 0;
+    return field->near
+        + Field_line(x, field->width, field->reach)
+        + field->lines * (Field_line(y, field->height, field->reach)
+            + field->lines * (Field_line(z, field->depth, field->reach)
+                + field->layers * (y & field->parity)));
+}
 
-#ifdef __OpenBSD__
-    pledge("stdio", NULL);
+int Field_isNear(const struct Field *field, unsigned x, unsigned y, unsigned z, unsigned i)
+{
+    const struct Field_Near *near = Field_near(field, x, y, z);
+
+    for (unsigned k = 0; k < near->count; ++k)
+        if (x + field->width * (y + field->height * z) + near->offset[k] == i)
+            return 1;
+    return 0;
+}
+
+void Field_touch(struct Field *field, unsigned i)
+{
+    if (field->dirty)
+        field->dirty[i / Field_CHUNK] = 1;
+}
+
+void Field_mine(struct Field *field, unsigned x, unsigned y, unsigned z)
+{
+    const struct Field_Near *near = Field_near(field, x, y, z);
+    struct Field_Cell *cur = field->field + x + field->width * (y + field->height * z);
+
+    ++cur->is_mine;
+
+    for (unsigned k = 0; k < near->count; ++k)
+        ++cur[near->offset[k]].mines_near;
+}
+
+/*
+ * Mines of large square fields are counted at once as sums of every row of
+ * three cells, then of three rows and then of three planes. Every sum is a
+ * plain loop over bytes, which the compiler vectorises. The sums are
+ * inlined into a kernel for every level of SIMD, see Kernel below.
+ */
+#define Field_SUM 4096
+/* gcc vectorises only the cheapest loops at -O2, clang does the rest too */
+#if defined(__GNUC__) && !defined(__clang__)
+#define Field_VECTORISE __attribute__((optimize("tree-vectorize")))
+#else
+#define Field_VECTORISE
 #endif
+#define Field_INLINE static inline __attribute__((always_inline)) Field_VECTORISE
 
-    while ((ch = getopt(argc, argv, "hSm:s:")) > 0)
+/* Bitfields are not vectorised, so the sums see a cell as its word */
+typedef Field_Word __attribute__((may_alias)) Field_Raw;
+
+_Static_assert(sizeof(struct Field_Cell) == sizeof(Field_Raw), "a cell is not one word");
+
+/* Folded to a constant: the bits of is_mine, or of mines_near if near */
+Field_INLINE Field_Word Field_mask(int near)
+{
+    union
     {
-        switch (ch)
-        {
-        case 's':
-        {
-            const char *e;
+        struct Field_Cell cell;
+        Field_Word word;
+    } u = {.word = 0};
 
-            is_seed_set = 1;
-            seed = strtonum(optarg, 0, UINT_MAX, &e);
-            if (e)
-            {
-                warnx("%s is %s: %s", "seed", e, optarg);
-                usage(0);
-            }
-        } break;
-        case 'm':
-        {
-            const char *e;
+    if (near)
+        u.cell.mines_near = Field_COUNT_MAX;
+    else
+        u.cell.is_mine = Field_MINE_MAX;
+    return u.word;
+}
 
-            is_mines_set = 1;
-            mines = strtonum(optarg, 0, UINT_MAX, &e);
-            if (e)
-            {
-                warnx("%s is %s: %s", "mines", e, optarg);
-                usage(0);
-            }
-        } break;
-        case 'S':
-        {
-            show_seed = 1;
-        } break;
-        case 'h':
-        {
-            usage(1);
-        } break;
-        default:
+Field_INLINE void Field_sumPlane(const struct Field *field, unsigned z, unsigned char *restrict mines, unsigned char *restrict rows, unsigned char *restrict plane)
+{
+    unsigned width = field->width, height = field->height, area = width * height;
+    const Field_Raw *cells = (const Field_Raw *)(field->field + z * area);
+    const Field_Word mask = Field_mask(0);
+
+    for (unsigned i = 0; i < area; ++i)
+        mines[i] = (cells[i] & mask) >> __builtin_ctz(mask);
+
+    for (unsigned y = 0; y < height; ++y)
+    {
+        const unsigned char *in = mines + y * width;
+        unsigned char *out = rows + y * width;
+
+        for (unsigned x = 1; x + 1 < width; ++x)
+            out[x] = in[x - 1] + in[x] + in[x + 1];
+        for (unsigned e = 0; e < 2 && e < width; ++e)
         {
-            usage(0);
-        } break;
+            unsigned x = e ? width - 1 : 0;
+
+            out[x] = in[x]
+                + (x > 0 ? in[x - 1] : field->wrap ? in[width - 1] : 0)
+                + (x + 1 < width ? in[x + 1] : field->wrap ? in[0] : 0);
         }
     }
-    argc -= optind;
-    argv += optind;
 
-    switch (argc)
+    for (unsigned y = 0; y < height; ++y)
     {
-    case 0:
-        break;
-    case 2:
+        const unsigned char *up = y > 0 ? rows + (y - 1) * width : field->wrap ? rows + (height - 1) * width : NULL;
+        const unsigned char *down = y + 1 < height ? rows + (y + 1) * width : field->wrap ? rows : NULL;
+        unsigned char *out = plane + y * width;
+
+        memcpy(out, rows + y * width, width);
+        for (unsigned x = 0; up && x < width; ++x)
+            out[x] += up[x];
+        for (unsigned x = 0; down && x < width; ++x)
+            out[x] += down[x];
+    }
+}
+
+/*
+ * Counts must be zero and fit into a byte, returns -1 if they do not or
+ * there is no memory for the sums.
+ */
+Field_INLINE int Field_sum(struct Field *field)
+{
+    unsigned area = field->width * field->height, depth = field->depth;
+    unsigned char *buffer, *mines, *rows, *sums, *planes[3];
+    unsigned tags[3] = {UINT_MAX, UINT_MAX, UINT_MAX};
+    int wrap = field->wrap && depth > 1;
+
+    if (field->most * Field_TOUCHING > UCHAR_MAX || !(buffer = malloc(6 * (size_t)area)))
+        return -1;
+    mines = buffer;
+    rows = buffer + area;
+    sums = buffer + 2 * area;
+    for (int s = 0; s < 3; ++s)
+        planes[s] = buffer + (3 + s) * (size_t)area;
+
+    for (unsigned z = 0; z < depth; ++z)
     {
-        char *names[] = {"width", "height"};
+        unsigned need[3] = {
+            z > 0 ? z - 1 : wrap ? depth - 1 : UINT_MAX,
+            z,
+            z + 1 < depth ? z + 1 : wrap ? 0 : UINT_MAX,
+        };
+        unsigned char *sum[3] = {NULL, NULL, NULL};
 
-        for (int i = 0; i < 2; ++i)
+        /* the three planes are kept, so every plane is summed once or twice */
+        for (int n = 0; n < 3; ++n)
         {
-            const char *e;
-
-            ((unsigned *)&field)[i] = strtonum(argv[i], 1, UINT_MAX, &e);
-            if (e)
+            for (int s = 0; need[n] != UINT_MAX && s < 3; ++s)
+                if (tags[s] == need[n])
+                    sum[n] = planes[s];
+            if (sum[n] || need[n] == UINT_MAX)
+                continue;
+            for (int s = 0; !sum[n] && s < 3; ++s)
             {
-                warnx("%s is %s: %s", names[i], e, argv[i]);
-                usage(0);
+                if (tags[s] != UINT_MAX
+                    && (tags[s] == need[0] || tags[s] == need[1] || tags[s] == need[2]))
+                    continue;
+                tags[s] = need[n];
+                sum[n] = planes[s];
+                Field_sumPlane(field, need[n], mines, rows, sum[n]);
             }
         }
-    } break;
+
+        memcpy(sums, sum[1], area);
+        for (unsigned i = 0; sum[0] && i < area; ++i)
+            sums[i] += sum[0][i];
+        for (unsigned i = 0; sum[2] && i < area; ++i)
+            sums[i] += sum[2][i];
+
+        Field_Raw *cells = (Field_Raw *)(field->field + z * area);
+        const Field_Word mask = Field_mask(1);
+        for (unsigned i = 0; i < area; ++i)
+            cells[i] = (cells[i] & ~mask) | (Field_Word)(sums[i] << __builtin_ctz(mask));
+    }
+
+    free(buffer);
+    return 0;
+}
+
+Field_VECTORISE
+int Field_sumGeneric(struct Field *field)
+{
+    return Field_sum(field);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define Kernel_X86 1
+
+__attribute__((target("sse2")))
+Field_VECTORISE
+int Field_sumSse2(struct Field *field)
+{
+    return Field_sum(field);
+}
+
+__attribute__((target("avx2")))
+Field_VECTORISE
+int Field_sumAvx2(struct Field *field)
+{
+    return Field_sum(field);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+Field_VECTORISE
+int Field_sumAvx512(struct Field *field)
+{
+    return Field_sum(field);
+}
+#else
+#define Kernel_X86 0
+#endif
+
+/*
+ * Kernels of every level of SIMD, built from the same code. The best level
+ * the CPU has is picked once at start, before any thread, and called
+ * through the current kernels. Levels that are not built are empty.
+ */
+enum Kernel_Level
+{
+    Kernel_Level_GENERIC,
+    Kernel_Level_SSE2,
+    Kernel_Level_AVX2,
+    Kernel_Level_AVX512,
+    Kernel_Level_COUNT,
+};
+
+const char *const Kernel_Level_NAMES[Kernel_Level_COUNT] = {
+    "generic",
+    "sse2",
+    "avx2",
+    "avx512",
+};
+
+struct Kernel
+{
+    int (*sum)(struct Field *field);
+};
+
+const struct Kernel Kernel_LEVELS[Kernel_Level_COUNT] = {
+    {Field_sumGeneric},
+#if Kernel_X86
+    {Field_sumSse2},
+    {Field_sumAvx2},
+    {Field_sumAvx512},
+#endif
+};
+
+struct Kernel Kernel_current = {Field_sumGeneric};
+
+int Kernel_supports(enum Kernel_Level level)
+{
+    if (!Kernel_LEVELS[level].sum)
+        return 0;
+
+    switch (level)
+    {
+#if Kernel_X86
+    case Kernel_Level_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case Kernel_Level_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case Kernel_Level_AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+        return 1;
+    }
+}
+
+/* Picks the given level or the best one if it is Kernel_Level_COUNT */
+int Kernel_select(enum Kernel_Level level)
+{
+#if Kernel_X86
+    __builtin_cpu_init();
+#endif
+    if (level == Kernel_Level_COUNT)
+        for (level = Kernel_Level_COUNT - 1; !Kernel_supports(level); --level);
+    else if (!Kernel_supports(level))
+        return -1;
+
+    Kernel_current = Kernel_LEVELS[level];
+    return 0;
+}
+
+/* Counts mines near every cell of a field with mines only placed */
+void Field_count(struct Field *field)
+{
+    unsigned i = 0;
+
+    if (field->topology == Field_Topology_OFFSETS + Field_Topology_SQUARE && !Kernel_current.sum(field))
+        return;
+
+    for (unsigned z = 0; z < field->depth; ++z)
+    {
+        for (unsigned y = 0; y < field->height; ++y)
+        {
+            for (unsigned x = 0; x < field->width; ++x, ++i)
+            {
+                if (!field->field[i].is_mine)
+                    continue;
+
+                const struct Field_Near *near = Field_near(field, x, y, z);
+                for (unsigned k = 0; k < near->count; ++k)
+                    field->field[i + near->offset[k]].mines_near += field->field[i].is_mine;
+            }
+        }
+    }
+}
+
+/*
+ * A cell holding many mines has as many slots, filled in order. A slot is
+ * drawn and taken if it is free, so every free slot is as likely, and a
+ * mine costs as many draws as with one mine a cell. The third coordinate
+ * and the slot are drawn only for fields that need them.
+ */
+unsigned Field_pick(struct Field *field, struct Random *random)
+{
+    unsigned x, y, z, slot, i;
+
+    do
+    {
+        x = Random_next(random) % field->width;
+        y = Random_next(random) % field->height;
+        z = field->depth > 1 ? Random_next(random) % field->depth : 0;
+        slot = field->most > 1 ? Random_next(random) % field->most : 0;
+        i = x + field->width * (y + field->height * z);
+    } while (field->field[i].is_mine > slot);
+
+    return i;
+}
+
+unsigned Field_place(struct Field *field, struct Random *random)
+{
+    unsigned i = Field_pick(field, random);
+
+    Field_mine(field, i % field->width, i / field->width % field->height, i / field->width / field->height);
+
+    return i;
+}
+
+void Field_generate(struct Field *field, unsigned mines, struct Random *random)
+{
+    if (Field_cells(field) < Field_SUM)
+    {
+        while (mines-- > 0)
+            Field_place(field, random);
+        return;
+    }
+
+    while (mines-- > 0)
+        ++field->field[Field_pick(field, random)].is_mine;
+    Field_count(field);
+}
+
+/*
+ * Mines are the first ones of the shuffled slots, where slot i is in cell
+ * i % cells.
+ */
+void Field_shuffle(struct Field *field, unsigned mines, const struct Shuffle *shuffle)
+{
+    unsigned cells = Field_cells(field), i;
+
+    if (cells >= Field_SUM)
+    {
+        while (mines-- > 0)
+            ++field->field[Shuffle_forward(shuffle, mines) % cells].is_mine;
+        Field_count(field);
+        return;
+    }
+
+    while (mines-- > 0)
+    {
+        i = Shuffle_forward(shuffle, mines) % cells;
+        Field_mine(field, i % field->width, i / field->width % field->height, i / field->width / field->height);
+    }
+}
+
+/*
+ * Generates only the window at x, y of a bordered flat shuffled field
+ * shaped as the given one into the field, which must be as large as the
+ * window and cleared.
+ */
+void Field_generateWindow(struct Field *window, unsigned x, unsigned y, const struct Field *shape, unsigned mines, const struct Shuffle *shuffle)
+{
+    unsigned reach = shape->topology->reach, cells = Field_cells(shape), mined;
+    const struct Field_Near *near;
+
+    for (unsigned yr = y > reach ? y - reach : 0; yr < y + window->height + reach && yr < shape->height; ++yr)
+    {
+        for (unsigned xr = x > reach ? x - reach : 0; xr < x + window->width + reach && xr < shape->width; ++xr)
+        {
+            mined = 0;
+            for (unsigned slot = 0; slot < shape->most; ++slot)
+                mined += Shuffle_backward(shuffle, xr + yr * shape->width + slot * cells) < mines;
+            if (!mined)
+                continue;
+
+            near = Field_near(shape, xr, yr, 0);
+            for (unsigned k = 0; k < near->count; ++k)
+            {
+                unsigned wx = xr + near->x[k] - x, wy = yr + near->y[k] - y;
+                if (wx >= window->width || wy >= window->height)
+                    continue;
+                window->field[wx + wy * window->width].mines_near += mined;
+                if (!near->x[k] && !near->y[k])
+                    window->field[wx + wy * window->width].is_mine = mined;
+            }
+        }
+    }
+}
+
+enum Field_Generator
+{
+    Field_Generator_RANDOM,
+    Field_Generator_SHUFFLE,
+};
+
+/* Random is left seeded with the same seed for anything that follows */
+void Field_seed(struct Field *field, unsigned mines, unsigned seed, enum Field_Generator generator, struct Random *random)
+{
+    struct Shuffle shuffle;
+
+    Random_seed(random, seed);
+    switch (generator)
+    {
+    case Field_Generator_RANDOM:
+    {
+        Field_generate(field, mines, random);
+    } break;
+    case Field_Generator_SHUFFLE:
+    {
+        Shuffle_init(&shuffle, Field_cells(field) * field->most, seed);
+        Field_shuffle(field, mines, &shuffle);
+    } break;
+    }
+}
+
+/*
+ * Opens empty regions breadth first, so the queue holds only their border
+ * and is on the stack unless the region is large.
+ */
+#define Field_QUEUE 64
+
+struct Field_Point
+{
+    unsigned x, y, z;
+};
+
+unsigned Field_open(struct Field *field, unsigned x, unsigned y, unsigned z)
+{
+    struct Field_Point local[Field_QUEUE], *queue = local, *grown, p;
+    unsigned size = Field_QUEUE, head = 0, count = 0, opened = 1, i;
+    const struct Field_Near *near;
+    struct Field_Cell *cur;
+
+    if (x >= field->width || y >= field->height || z >= field->depth)
+        return 0;
+
+    i = x + field->width * (y + field->height * z);
+    if (field->field[i].status != Field_Cell_Status_OPENED)
+        field->field[i].status = Field_Cell_Status_OPENED;
+    else
+        return 0;
+    Field_touch(field, i);
+
+    if (field->field[i].mines_near != 0)
+        return opened;
+
+    queue[count++] = (struct Field_Point){x, y, z};
+    while (count > 0)
+    {
+        p = queue[head];
+        head = (head + 1) & (size - 1);
+        --count;
+
+        near = Field_near(field, p.x, p.y, p.z);
+        i = p.x + field->width * (p.y + field->height * p.z);
+        for (unsigned k = 0; k < near->count; ++k)
+        {
+            cur = field->field + i + near->offset[k];
+            if (cur->status == Field_Cell_Status_OPENED)
+                continue;
+            cur->status = Field_Cell_Status_OPENED;
+            Field_touch(field, i + near->offset[k]);
+            ++opened;
+            if (cur->mines_near)
+                continue;
+
+            if (count == size)
+            {
+                if (!(grown = malloc(2 * size * sizeof(*grown))))
+                    err(1, "malloc()");
+                for (unsigned q = 0; q < count; ++q)
+                    grown[q] = queue[(head + q) & (size - 1)];
+                if (queue != local)
+                    free(queue);
+                queue = grown;
+                head = 0;
+                size *= 2;
+            }
+            queue[(head + count++) & (size - 1)] = (struct Field_Point){
+                p.x + near->x[k],
+                p.y + near->y[k],
+                p.z + near->z[k],
+            };
+        }
+    }
+
+    if (queue != local)
+        free(queue);
+    return opened;
+}
+
+/*
+ * A writer marks its changes of the field, so readers can copy it while it
+ * is played. Readers never block the writer: they copy all cells and
+ * copy them again if the sequence moved meanwhile. Cells are read a word
+ * at a time, so a copy that raced with a write is only thrown away.
+ *
+ * The writer still stores cells as plain bit-fields, so the moves, the
+ * solver and the history stay as fast as without readers. Its stores race
+ * with the copy, which C leaves undefined but every target does a word at
+ * once, as the seqlocks of kernels rely on; the copy is hidden from TSan.
+ */
+void Field_writeBegin(struct Field *field)
+{
+    unsigned sequence = atomic_load_explicit(&field->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&field->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void Field_writeEnd(struct Field *field)
+{
+    unsigned sequence = atomic_load_explicit(&field->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&field->sequence, sequence + 1, memory_order_release);
+}
+
+/* Copies the cells as they were between two moves, returns times it retried */
+__attribute__((no_sanitize("thread")))
+unsigned Field_snapshot(struct Field *field, struct Field_Cell *cells)
+{
+    const Field_Raw *from = (const Field_Raw *)field->field;
+    Field_Raw *to = (Field_Raw *)cells;
+    unsigned count = Field_cells(field), retries = 0, before;
+
+    for (;; ++retries)
+    {
+        /* the writer may be off the CPU in the middle of a move */
+        while ((before = atomic_load_explicit(&field->sequence, memory_order_acquire)) & 1)
+            sched_yield();
+        for (unsigned i = 0; i < count; ++i)
+            to[i] = __atomic_load_n(from + i, __ATOMIC_RELAXED);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&field->sequence, memory_order_relaxed) == before)
+            return retries;
+    }
+}
+
+/*
+ * Locks of a field opened by many threads at once. A tile is Field_TILE
+ * chunks in a row, so its cells and their dirty bytes are only written
+ * under its lock and cascades in distant parts of the field never meet.
+ */
+#define Field_TILE 64
+#define Field_TILE_CELLS (Field_TILE * Field_CHUNK)
+
+struct Field_Tile
+{
+    _Alignas(64) pthread_mutex_t lock;
+    /* written under the lock, waits are the times it was already taken */
+    uint64_t locks, waits;
+};
+
+struct Field_Tiles
+{
+    struct Field_Tile *tiles;
+    unsigned count;
+};
+
+int Field_Tiles_init(struct Field_Tiles *tiles, const struct Field *field)
+{
+    tiles->count = (Field_cells(field) + Field_TILE_CELLS - 1) / Field_TILE_CELLS;
+    if (!(tiles->tiles = aligned_alloc(_Alignof(struct Field_Tile), tiles->count * sizeof(*tiles->tiles))))
+        return -1;
+    for (unsigned t = 0; t < tiles->count; ++t)
+    {
+        pthread_mutex_init(&tiles->tiles[t].lock, NULL);
+        tiles->tiles[t].locks = tiles->tiles[t].waits = 0;
+    }
+    return 0;
+}
+
+void Field_Tiles_free(struct Field_Tiles *tiles)
+{
+    for (unsigned t = 0; t < tiles->count; ++t)
+        pthread_mutex_destroy(&tiles->tiles[t].lock);
+    free(tiles->tiles);
+    *tiles = (struct Field_Tiles){0};
+}
+
+void Field_Tiles_lock(struct Field_Tiles *tiles, unsigned tile)
+{
+    struct Field_Tile *t = tiles->tiles + tile;
+    int busy = pthread_mutex_trylock(&t->lock) != 0;
+
+    if (busy)
+        pthread_mutex_lock(&t->lock);
+    ++t->locks;
+    t->waits += busy;
+}
+
+struct Field_Points
+{
+    struct Field_Point *points;
+    unsigned count, size;
+};
+
+void Field_Points_push(struct Field_Points *points, unsigned x, unsigned y, unsigned z)
+{
+    if (points->count == points->size)
+    {
+        points->size = points->size ? 2 * points->size : Field_QUEUE;
+        if (!(points->points = realloc(points->points, points->size * sizeof(*points->points))))
+            err(1, "realloc()");
+    }
+    points->points[points->count++] = (struct Field_Point){x, y, z};
+}
+
+/*
+ * Field_open for a field shared by threads. A thread holds one tile at a
+ * time, so there is no order to take them in and nothing to deadlock on:
+ * cells of other tiles a cascade reaches are put aside and opened once
+ * their own tile is locked. Returns the amount of cells opened by the call.
+ */
+unsigned Field_openShared(struct Field *field, struct Field_Tiles *tiles, unsigned x, unsigned y, unsigned z)
+{
+    struct Field_Points local = {0}, other = {0};
+    struct Field_Point p;
+    const struct Field_Near *near;
+    struct Field_Cell *cur;
+    unsigned opened = 0, tile, i, j;
+
+    if (x >= field->width || y >= field->height || z >= field->depth)
+        return 0;
+
+    Field_Points_push(&other, x, y, z);
+    while (other.count > 0)
+    {
+        p = other.points[--other.count];
+        i = p.x + field->width * (p.y + field->height * p.z);
+        tile = i / Field_TILE_CELLS;
+
+        Field_Tiles_lock(tiles, tile);
+        if (field->field[i].status != Field_Cell_Status_OPENED)
+        {
+            field->field[i].status = Field_Cell_Status_OPENED;
+            Field_touch(field, i);
+            ++opened;
+            if (!field->field[i].mines_near)
+                Field_Points_push(&local, p.x, p.y, p.z);
+        }
+
+        while (local.count > 0)
+        {
+            p = local.points[--local.count];
+            near = Field_near(field, p.x, p.y, p.z);
+            i = p.x + field->width * (p.y + field->height * p.z);
+            for (unsigned k = 0; k < near->count; ++k)
+            {
+                j = i + near->offset[k];
+                if (j / Field_TILE_CELLS != tile)
+                {
+                    Field_Points_push(&other, p.x + near->x[k], p.y + near->y[k], p.z + near->z[k]);
+                    continue;
+                }
+
+                cur = field->field + j;
+                if (cur->status == Field_Cell_Status_OPENED)
+                    continue;
+                cur->status = Field_Cell_Status_OPENED;
+                Field_touch(field, j);
+                ++opened;
+                if (!cur->mines_near)
+                    Field_Points_push(&local, p.x + near->x[k], p.y + near->y[k], p.z + near->z[k]);
+            }
+        }
+        pthread_mutex_unlock(&tiles->tiles[tile].lock);
+    }
+
+    free(local.points);
+    free(other.points);
+    return opened;
+}
+
+/* Won when only cells with mines are closed, however many they hold */
+int Field_isWin(struct Field *field)
+{
+    int closed = 0, mined = 0;
+    for (unsigned i = 0; i < Field_cells(field); ++i)
+    {
+        if (field->field[i].is_mine && field->field[i].status == Field_Cell_Status_OPENED)
+            return -1;
+        closed += field->field[i].status != Field_Cell_Status_OPENED;
+        mined += !!field->field[i].is_mine;
+    }
+    return closed == mined;
+}
+
+enum Field_Metric
+{
+    Field_Metric_3BV,
+    Field_Metric_OPENINGS,
+    Field_Metric_CLICK,
+    Field_Metric_COUNT,
+};
+
+const char *const Field_Metric_NAMES[Field_Metric_COUNT] = {
+    "3bv",
+    "openings",
+    "click",
+};
+
+/*
+ * 3bv is the amount of clicks needed to clear the field: every opening and
+ * every number not touching one. Click is the amount of cells opened by
+ * the first click at 1x1. This opens the whole field on its way.
+ */
+void Field_measure(struct Field *field, uint32_t metrics[Field_Metric_COUNT])
+{
+    struct Field_Cell c = field->field[0];
+    unsigned bbbv = 0, openings = !c.is_mine && !c.mines_near, i = 0;
+
+    metrics[Field_Metric_CLICK] = c.is_mine ? 0 : c.mines_near ? 1 : Field_open(field, 0, 0, 0);
+    for (unsigned z = 0; z < field->depth; ++z)
+    {
+        for (unsigned y = 0; y < field->height; ++y)
+        {
+            for (unsigned x = 0; x < field->width; ++x, ++i)
+            {
+                c = field->field[i];
+                if (c.is_mine || c.mines_near || c.status == Field_Cell_Status_OPENED)
+                    continue;
+                ++openings;
+                Field_open(field, x, y, z);
+            }
+        }
+    }
+
+    for (i = 0; i < Field_cells(field); ++i)
+        bbbv += !field->field[i].is_mine && field->field[i].status != Field_Cell_Status_OPENED;
+
+    metrics[Field_Metric_3BV] = bbbv + openings;
+    metrics[Field_Metric_OPENINGS] = openings;
+}
+
+/* Numbers above 9 are shown as letters, ones above Z as a star */
+const char Field_NUMBERS[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+char Field_number(unsigned count)
+{
+    return count < sizeof(Field_NUMBERS) - 1 ? Field_NUMBERS[count] : '*';
+}
+
+/* Shows the slice at the given depth */
+void Field_print(struct Field *field, unsigned z, FILE *out)
+{
+    for (unsigned y = 0; y < field->height; ++y)
+    {
+        if (y & field->topology->parity)
+            putc(' ', out);
+        for (unsigned x = 0; x < field->width; ++x)
+        {
+            struct Field_Cell c = field->field[x + field->width * (y + field->height * z)];
+            switch (c.status)
+            {
+            case Field_Cell_Status_HIDDEN:
+            case Field_Cell_Status_SAFE:
+            {
+                fprintf(out, c.is_selected ? "X]" : "[]");
+            } break;
+            case Field_Cell_Status_FLAGGED:
+            {
+                fprintf(out, c.is_selected ? "X?" : "??");
+            } break;
+            case Field_Cell_Status_OPENED:
+            {
+                if (c.is_mine)
+                    fprintf(out, c.is_selected ? "X#" : "##");
+                else
+                    fprintf(out, c.is_selected ? "X%c" : " %c", Field_number(c.mines_near));
+            } break;
+            }
+        }
+        putc('\n', out);
+    }
+}
+
+/*
+ * Persistent versions of a field: a table of pages of chunks of cells,
+ * where every node is shared by reference between versions. A new version
+ * copies only chunks marked dirty in the field and the pages leading to
+ * them, so a move costs as much memory as it changed.
+ *
+ * A version can be forked for free and written through Field_Version_set,
+ * which copies the nodes on the way that are shared with anyone else, so
+ * every fork sees only its own writes. References are atomic, so forks of
+ * one version can be used by different threads.
+ */
+#define Field_Version_PAGE 64
+
+struct Field_Chunk
+{
+    _Atomic unsigned refs;
+    struct Field_Cell cells[Field_CHUNK];
+};
+
+struct Field_Page
+{
+    _Atomic unsigned refs;
+    struct Field_Chunk *chunks[Field_Version_PAGE];
+};
+
+struct Field_Version
+{
+    _Atomic unsigned refs;
+    unsigned width, height, depth, chunks, pages;
+    struct Field_Page *page[];
+};
+
+void Field_Page_free(struct Field_Page *page)
+{
+    if (!page || --page->refs)
+        return;
+
+    for (unsigned c = 0; c < Field_Version_PAGE; ++c)
+        if (page->chunks[c] && !--page->chunks[c]->refs)
+            free(page->chunks[c]);
+    free(page);
+}
+
+void Field_Version_free(struct Field_Version *version)
+{
+    if (!version || --version->refs)
+        return;
+
+    for (unsigned p = 0; p < version->pages; ++p)
+        Field_Page_free(version->page[p]);
+    free(version);
+}
+
+struct Field_Version *Field_Version_fork(struct Field_Version *version)
+{
+    ++version->refs;
+    return version;
+}
+
+struct Field_Cell Field_Version_get(const struct Field_Version *version, unsigned i)
+{
+    return version->page[i / Field_CHUNK / Field_Version_PAGE]->chunks[i / Field_CHUNK % Field_Version_PAGE]->cells[i % Field_CHUNK];
+}
+
+/* Version may be replaced by its copy, NULL is returned if it cannot be */
+struct Field_Cell *Field_Version_set(struct Field_Version **versionp, unsigned i)
+{
+    struct Field_Version *version = *versionp;
+    struct Field_Page *page, **pagep;
+    struct Field_Chunk *chunk, **chunkp;
+
+    if (version->refs > 1)
+    {
+        size_t size = sizeof(*version) + version->pages * sizeof(*version->page);
+
+        if (!(version = malloc(size)))
+            return NULL;
+        memcpy(version, *versionp, size);
+        version->refs = 1;
+        for (unsigned p = 0; p < version->pages; ++p)
+            ++version->page[p]->refs;
+        Field_Version_free(*versionp);
+        *versionp = version;
+    }
+
+    pagep = version->page + i / Field_CHUNK / Field_Version_PAGE;
+    if ((*pagep)->refs > 1)
+    {
+        if (!(page = malloc(sizeof(*page))))
+            return NULL;
+        memcpy(page, *pagep, sizeof(*page));
+        page->refs = 1;
+        for (unsigned c = 0; c < Field_Version_PAGE; ++c)
+            if (page->chunks[c])
+                ++page->chunks[c]->refs;
+        Field_Page_free(*pagep);
+        *pagep = page;
+    }
+
+    chunkp = (*pagep)->chunks + i / Field_CHUNK % Field_Version_PAGE;
+    if ((*chunkp)->refs > 1)
+    {
+        if (!(chunk = malloc(sizeof(*chunk))))
+            return NULL;
+        memcpy(chunk, *chunkp, sizeof(*chunk));
+        chunk->refs = 1;
+        if (!--(*chunkp)->refs)
+            free(*chunkp);
+        *chunkp = chunk;
+    }
+
+    return (*chunkp)->cells + i % Field_CHUNK;
+}
+
+/* Base is NULL for the first version, which copies every chunk */
+struct Field_Version *Field_Version_commit(struct Field_Version *base, struct Field *field)
+{
+    unsigned chunks = (Field_cells(field) + Field_CHUNK - 1) / Field_CHUNK;
+    unsigned pages = (chunks + Field_Version_PAGE - 1) / Field_Version_PAGE;
+    struct Field_Version *version;
+    struct Field_Page *page;
+    struct Field_Chunk *chunk;
+
+    if (!(version = calloc(1, sizeof(*version) + pages * sizeof(*version->page))))
+        return NULL;
+    *version = (struct Field_Version){
+        .refs = 1,
+        .width = field->width,
+        .height = field->height,
+        .depth = field->depth,
+        .chunks = chunks,
+        .pages = pages,
+    };
+
+    for (unsigned p = 0; p < pages; ++p)
+    {
+        unsigned first = p * Field_Version_PAGE, dirty = !base;
+
+        for (unsigned c = first; !dirty && c < first + Field_Version_PAGE && c < chunks; ++c)
+            dirty = field->dirty[c];
+        if (!dirty)
+        {
+            ++(version->page[p] = base->page[p])->refs;
+            continue;
+        }
+
+        if (!(page = calloc(1, sizeof(*page))))
+            goto fail;
+        page->refs = 1;
+        version->page[p] = page;
+
+        for (unsigned c = first; c < first + Field_Version_PAGE && c < chunks; ++c)
+        {
+            if (base && !field->dirty[c])
+            {
+                ++(page->chunks[c - first] = base->page[p]->chunks[c - first])->refs;
+                continue;
+            }
+
+            unsigned count = Field_cells(field) - c * Field_CHUNK;
+            if (!(chunk = calloc(1, sizeof(*chunk))))
+                goto fail;
+            chunk->refs = 1;
+            memcpy(chunk->cells, field->field + c * Field_CHUNK, (count < Field_CHUNK ? count : Field_CHUNK) * sizeof(*chunk->cells));
+            page->chunks[c - first] = chunk;
+        }
+    }
+
+    if (base)
+        memset(field->dirty, 0, chunks);
+    return version;
+
+fail:
+    Field_Version_free(version);
+    return NULL;
+}
+
+/*
+ * Brings the field from one version to another copying only chunks that
+ * differ. The selection is not a part of the game, so it is cleared.
+ */
+void Field_Version_restore(struct Field_Version *from, struct Field_Version *to, struct Field *field)
+{
+    for (unsigned p = 0; p < to->pages; ++p)
+    {
+        if (from->page[p] == to->page[p])
+            continue;
+
+        for (unsigned c = 0; c < Field_Version_PAGE; ++c)
+        {
+            struct Field_Chunk *chunk = to->page[p]->chunks[c];
+            unsigned first = (p * Field_Version_PAGE + c) * Field_CHUNK;
+            unsigned count;
+
+            if (!chunk || chunk == from->page[p]->chunks[c])
+                continue;
+
+            count = Field_cells(field) - first;
+            count = count < Field_CHUNK ? count : Field_CHUNK;
+            memcpy(field->field + first, chunk->cells, count * sizeof(*chunk->cells));
+            for (unsigned i = 0; i < count; ++i)
+                field->field[first + i].is_selected = 0;
+        }
+    }
+}
+
+struct Field_History
+{
+    struct Field_Version **versions;
+    unsigned count, current, size;
+    /* the most versions kept, the oldest is forgotten first, or 0 for all */
+    unsigned limit;
+};
+
+/* Remembers the field as it is now, forgetting everything undone */
+int Field_History_push(struct Field_History *history, struct Field *field)
+{
+    struct Field_Version *version, *base = history->count ? history->versions[history->current] : NULL;
+    unsigned chunks = (Field_cells(field) + Field_CHUNK - 1) / Field_CHUNK;
+    int dirty = !base;
+
+    for (unsigned c = 0; !dirty && c < chunks; ++c)
+        dirty = field->dirty[c];
+    if (!dirty)
+        return 0;
+
+    if (history->current + 2 > history->size)
+    {
+        struct Field_Version **versions;
+        unsigned size = history->size ? history->size * 2 : 16;
+
+        if (!(versions = realloc(history->versions, size * sizeof(*versions))))
+            return -1;
+        history->versions = versions;
+        history->size = size;
+    }
+    if (!(version = Field_Version_commit(base, field)))
+        return -1;
+
+    while (history->count > history->current + !!base)
+        Field_Version_free(history->versions[--history->count]);
+    history->current = history->count;
+    history->versions[history->count++] = version;
+    if (history->limit && history->count > history->limit)
+    {
+        Field_Version_free(history->versions[0]);
+        memmove(history->versions, history->versions + 1, --history->count * sizeof(*history->versions));
+        --history->current;
+    }
+    return 0;
+}
+
+void Field_History_free(struct Field_History *history)
+{
+    while (history->count > 0)
+        Field_Version_free(history->versions[--history->count]);
+    free(history->versions);
+    *history = (struct Field_History){0};
+}
+
+int Field_History_undo(struct Field_History *history, struct Field *field)
+{
+    if (history->current == 0)
+        return -1;
+
+    Field_Version_restore(history->versions[history->current], history->versions[history->current - 1], field);
+    --history->current;
+    return 0;
+}
+
+int Field_History_redo(struct Field_History *history, struct Field *field)
+{
+    if (history->current + 1 >= history->count)
+        return -1;
+
+    Field_Version_restore(history->versions[history->current], history->versions[history->current + 1], field);
+    ++history->current;
+    return 0;
+}
+
+/*
+ * Plays like a careful human: opens or flags what a single number proves,
+ * then what one supposition disproves, and guesses a random hidden cell
+ * when nothing is proven.
+ */
+unsigned Solver_deduce(struct Field *field)
+{
+    unsigned moves = 0, i = 0;
+
+    for (unsigned z = 0; z < field->depth; ++z)
+    {
+        for (unsigned y = 0; y < field->height; ++y)
+        {
+            for (unsigned x = 0; x < field->width; ++x, ++i)
+            {
+                struct Field_Cell c = field->field[i];
+                const struct Field_Near *near;
+                unsigned hidden = 0, flagged = 0;
+                enum Field_Cell_Status to;
+
+                if (c.status != Field_Cell_Status_OPENED || c.is_mine || !c.mines_near)
+                    continue;
+
+                near = Field_near(field, x, y, z);
+                for (unsigned k = 0; k < near->count; ++k)
+                {
+                    hidden += field->field[i + near->offset[k]].status == Field_Cell_Status_HIDDEN;
+                    flagged += field->field[i + near->offset[k]].status == Field_Cell_Status_FLAGGED;
+                }
+
+                /* a flag holds at least one mine, a hidden cell up to most */
+                if (!hidden)
+                    continue;
+                else if (flagged == c.mines_near)
+                    to = Field_Cell_Status_OPENED;
+                else if ((flagged + hidden - 1) * field->most < c.mines_near)
+                    to = Field_Cell_Status_FLAGGED;
+                else
+                    continue;
+
+                for (unsigned k = 0; k < near->count; ++k)
+                {
+                    if (field->field[i + near->offset[k]].status != Field_Cell_Status_HIDDEN)
+                        continue;
+                    if (to == Field_Cell_Status_OPENED)
+                        Field_open(field, x + near->x[k], y + near->y[k], z + near->z[k]);
+                    else
+                        field->field[i + near->offset[k]].status = to;
+                    ++moves;
+                }
+            }
+        }
+    }
+
+    return moves;
+}
+
+/*
+ * Supposes the cell is a mine or safe in a branch and follows what single
+ * numbers prove from there. A number that cannot be satisfied any more
+ * means the supposition was wrong.
+ */
+int Solver_contradicts(const struct Field *shape, struct Field_Version **branch, unsigned i, enum Field_Cell_Status status, unsigned *stack)
+{
+    unsigned width = shape->width, height = shape->height, top = 0;
+    unsigned x, y, z, xr, yr, zr, n, hidden, flagged;
+    const struct Field_Near *near, *around;
+    struct Field_Cell c, *cur;
+
+    if (!(cur = Field_Version_set(branch, i)))
+        return 0;
+    cur->status = status;
+    stack[top++] = i;
+
+    while (top > 0)
+    {
+        i = stack[--top];
+        x = i % width;
+        y = i / width % height;
+        z = i / width / height;
+        near = Field_near(shape, x, y, z);
+
+        for (unsigned k = 0; k < near->count; ++k)
+        {
+            xr = x + near->x[k];
+            yr = y + near->y[k];
+            zr = z + near->z[k];
+            c = Field_Version_get(*branch, i + near->offset[k]);
+            if (c.status != Field_Cell_Status_OPENED || c.is_mine)
+                continue;
+
+            around = Field_near(shape, xr, yr, zr);
+            hidden = flagged = 0;
+            for (unsigned kn = 0; kn < around->count; ++kn)
+            {
+                n = i + near->offset[k] + around->offset[kn];
+                hidden += Field_Version_get(*branch, n).status == Field_Cell_Status_HIDDEN;
+                flagged += Field_Version_get(*branch, n).status == Field_Cell_Status_FLAGGED;
+            }
+
+            if (flagged > c.mines_near || (flagged + hidden) * shape->most < c.mines_near)
+                return 1;
+            else if (!hidden)
+                continue;
+            else if (flagged == c.mines_near)
+                status = Field_Cell_Status_SAFE;
+            else if ((flagged + hidden - 1) * shape->most < c.mines_near)
+                status = Field_Cell_Status_FLAGGED;
+            else
+                continue;
+
+            for (unsigned kn = 0; kn < around->count; ++kn)
+            {
+                n = i + near->offset[k] + around->offset[kn];
+                if (Field_Version_get(*branch, n).status != Field_Cell_Status_HIDDEN)
+                    continue;
+                if (!(cur = Field_Version_set(branch, n)))
+                    return 0;
+                cur->status = status;
+                stack[top++] = n;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Looks one supposition ahead for every hidden cell next to a number,
+ * each in its own fork of the field. Returns amount of moves done.
+ */
+unsigned Solver_suppose(struct Field *field)
+{
+    unsigned cells = Field_cells(field), *stack, x, y, z, opened;
+    const struct Field_Near *near;
+    struct Field_Version *base = NULL, *branch;
+    unsigned moves = 0;
+
+    if (!(stack = malloc(cells * sizeof(*stack))) || !(base = Field_Version_commit(NULL, field)))
+        goto end;
+
+    for (unsigned i = 0; i < cells && !moves; ++i)
+    {
+        if (field->field[i].status != Field_Cell_Status_HIDDEN)
+            continue;
+
+        x = i % field->width;
+        y = i / field->width % field->height;
+        z = i / field->width / field->height;
+        near = Field_near(field, x, y, z);
+        opened = 0;
+        for (unsigned k = 0; k < near->count; ++k)
+            opened |= field->field[i + near->offset[k]].status == Field_Cell_Status_OPENED;
+        if (!opened)
+            continue;
+
+        branch = Field_Version_fork(base);
+        if (Solver_contradicts(field, &branch, i, Field_Cell_Status_FLAGGED, stack))
+            moves = Field_open(field, x, y, z) > 0;
+        Field_Version_free(branch);
+        if (moves)
+            break;
+
+        branch = Field_Version_fork(base);
+        if (Solver_contradicts(field, &branch, i, Field_Cell_Status_SAFE, stack))
+        {
+            field->field[i].status = Field_Cell_Status_FLAGGED;
+            Field_touch(field, i);
+            moves = 1;
+        }
+        Field_Version_free(branch);
+    }
+
+end:
+    Field_Version_free(base);
+    free(stack);
+    return moves;
+}
+
+int Solver_solve(struct Field *field, unsigned x, unsigned y, unsigned z)
+{
+    int win;
+
+    Field_open(field, x, y, z);
+    while (!(win = Field_isWin(field)) && (Solver_deduce(field) || Solver_suppose(field)));
+
+    return win > 0;
+}
+
+int Solver_play(struct Field *field, struct Random *random, unsigned *moves)
+{
+    unsigned cells = Field_cells(field), hidden, done, i;
+    int win;
+
+    *moves = 0;
+    while (!(win = Field_isWin(field)))
+    {
+        if ((done = Solver_deduce(field)) || (done = Solver_suppose(field)))
+        {
+            *moves += done;
+            continue;
+        }
+
+        hidden = 0;
+        for (i = 0; i < cells; ++i)
+            hidden += field->field[i].status == Field_Cell_Status_HIDDEN;
+        hidden = Random_next(random) % hidden;
+        for (i = 0; field->field[i].status != Field_Cell_Status_HIDDEN || hidden--; ++i);
+
+        Field_open(field, i % field->width, i / field->width % field->height, i / field->width / field->height);
+        ++*moves;
+    }
+
+    return win;
+}
+
+/*
+ * One pool of threads runs every parallel job, so jobs never compete for
+ * cores. A job is a range of items cut in blocks of its grain. Every
+ * worker starts with its share of blocks, splits the range it holds in
+ * halves and pushes the upper one to the bottom of its deque, and an idle
+ * worker steals from the top of another deque, which is the largest piece
+ * left there (Chase-Lev). Halving keeps a deque under 33 ranges, so it
+ * never grows, and a range is its first and last block in one word.
+ */
+#define Pool_DEQUE 64
+
+struct Pool_Deque
+{
+    _Alignas(64) _Atomic int64_t top;
+    _Alignas(64) _Atomic int64_t bottom;
+    _Atomic uint64_t tasks[Pool_DEQUE];
+};
+
+struct Pool_Job
+{
+    /* runs items from first to last on the worker, 0 stops the job */
+    int (*run)(void *context, unsigned worker, uint64_t first, uint64_t last);
+    /* called about every second while the job runs, if set */
+    void (*progress)(void *context);
+    void *context;
+    /* blocks of the job are counted in 32 bits */
+    uint64_t count, grain;
+    /* ranges of blocks from it on are dropped unsplit as it is lowered, if set */
+    _Atomic uint64_t *bound;
+};
+
+struct Pool_Worker
+{
+    struct Pool_Deque deque;
+    struct Pool *pool;
+    pthread_t thread;
+    unsigned index;
+};
+
+struct Pool
+{
+    struct Pool_Worker *workers;
+    unsigned threads;
+    struct Pool_Job *job;
+    _Atomic uint64_t left;
+    _Atomic int stop;
+    /* workers waiting on work for a block to steal or the end of the job */
+    _Atomic unsigned idle;
+    pthread_mutex_t lock;
+    pthread_cond_t wake, work, done;
+    unsigned generation, busy;
+    int quit;
+};
+
+void Pool_push(struct Pool_Deque *deque, uint64_t task)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+
+    atomic_store_explicit(deque->tasks + (bottom & (Pool_DEQUE - 1)), task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+int Pool_take(struct Pool_Deque *deque, uint64_t *task)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1, top;
+    int taken = 1;
+
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (top > bottom)
+    {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return 0;
+    }
+
+    *task = atomic_load_explicit(deque->tasks + (bottom & (Pool_DEQUE - 1)), memory_order_relaxed);
+    if (top == bottom)
+    {
+        /* a thief may be taking the last one too */
+        taken = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return taken;
+}
+
+int Pool_steal(struct Pool_Deque *deque, uint64_t *task)
+{
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire), bottom;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom)
+        return 0;
+
+    *task = atomic_load_explicit(deque->tasks + (top & (Pool_DEQUE - 1)), memory_order_relaxed);
+    return atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+/*
+ * A worker with nothing to take or steal sleeps until a block is pushed
+ * or the last one is run. It counts itself idle before it looks at the
+ * deques once more and whoever pushes looks at idle after pushing, so
+ * one of them always sees the other and no wakeup is lost.
+ */
+void Pool_wait(struct Pool *pool)
+{
+    int ready = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->idle, 1);
+    for (unsigned i = 0; !ready && i < pool->threads; ++i)
+        ready = atomic_load(&pool->workers[i].deque.top) < atomic_load(&pool->workers[i].deque.bottom);
+    if (!ready && atomic_load(&pool->left))
+        pthread_cond_wait(&pool->work, &pool->lock);
+    atomic_fetch_sub(&pool->idle, 1);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void Pool_notify(struct Pool *pool)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&pool->idle, memory_order_relaxed))
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void Pool_work(struct Pool *pool, struct Pool_Worker *worker)
+{
+    struct Pool_Job *job = pool->job;
+    uint64_t task, first, last, middle;
+    int got;
+
+    while (atomic_load_explicit(&pool->left, memory_order_acquire))
+    {
+        got = Pool_take(&worker->deque, &task);
+        for (unsigned i = 1; !got && i < pool->threads; ++i)
+            got = Pool_steal(&pool->workers[(worker->index + i) % pool->threads].deque, &task);
+        if (!got)
+        {
+            Pool_wait(pool);
+            continue;
+        }
+
+        first = task >> 32;
+        last = task & UINT32_MAX;
+        if (job->bound && first * job->grain >= atomic_load_explicit(job->bound, memory_order_relaxed))
+        {
+            if (atomic_fetch_sub(&pool->left, last - first) == last - first)
+                Pool_notify(pool);
+            continue;
+        }
+
+        for (; last - first > 1; last = middle)
+        {
+            middle = first + (last - first) / 2;
+            Pool_push(&worker->deque, middle << 32 | last);
+        }
+        if (last != (task & UINT32_MAX))
+            Pool_notify(pool);
+        last = (first + 1) * job->grain < job->count ? (first + 1) * job->grain : job->count;
+        if (!atomic_load_explicit(&pool->stop, memory_order_relaxed)
+            && !job->run(job->context, worker->index, first * job->grain, last))
+            atomic_store_explicit(&pool->stop, 1, memory_order_relaxed);
+        if (atomic_fetch_sub(&pool->left, 1) == 1)
+            Pool_notify(pool);
+    }
+}
+
+void *Pool_thread(void *arg)
+{
+    struct Pool_Worker *worker = arg;
+    struct Pool *pool = worker->pool;
+    unsigned generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (pool->generation == generation && !pool->quit)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->quit)
+            break;
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        Pool_work(pool, worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (!--pool->busy)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Pins the thread to the CPU that is index-th of the ones the process may use */
+int Pool_pin(pthread_t thread, unsigned index)
+{
+#ifdef __linux__
+    cpu_set_t allowed, set;
+    int cpu = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return -1;
+    for (index %= CPU_COUNT(&allowed); !CPU_ISSET(cpu, &allowed) || index--; ++cpu);
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return (errno = pthread_setaffinity_np(thread, sizeof(set), &set)) ? -1 : 0;
+#else
+    (void)thread;
+    (void)index;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+void Pool_init(struct Pool *pool, unsigned threads, int pin)
+{
+    unsigned started;
+
+    *pool = (struct Pool){
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .wake = PTHREAD_COND_INITIALIZER,
+        .work = PTHREAD_COND_INITIALIZER,
+        .done = PTHREAD_COND_INITIALIZER,
+    };
+    if (!(pool->workers = aligned_alloc(_Alignof(struct Pool_Worker), threads * sizeof(*pool->workers))))
+        err(1, "aligned_alloc()");
+    memset(pool->workers, 0, threads * sizeof(*pool->workers));
+
+    for (started = 0; started < threads; ++started)
+    {
+        pool->workers[started].pool = pool;
+        pool->workers[started].index = started;
+        if ((errno = pthread_create(&pool->workers[started].thread, NULL, Pool_thread, pool->workers + started)))
+        {
+            warn("pthread_create()");
+            break;
+        }
+        if (pin && Pool_pin(pool->workers[started].thread, started) < 0)
+            warn("cannot pin thread %u", started);
+    }
+    if (started == 0)
+        errx(1, "cannot start any thread");
+    pool->threads = started;
+}
+
+void Pool_free(struct Pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned i = 0; i < pool->threads; ++i)
+        pthread_join(pool->workers[i].thread, NULL);
+    free(pool->workers);
+}
+
+/* Returns when every item of the job is run or the job is stopped */
+void Pool_run(struct Pool *pool, struct Pool_Job *job)
+{
+    uint64_t blocks = (job->count + job->grain - 1) / job->grain;
+    unsigned shares = blocks < pool->threads ? blocks : pool->threads;
+    struct timespec wake;
+
+    if (blocks == 0)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    atomic_store(&pool->stop, 0);
+    atomic_store(&pool->left, blocks);
+    for (unsigned i = 0; i < pool->threads; ++i)
+    {
+        atomic_store(&pool->workers[i].deque.top, 0);
+        atomic_store(&pool->workers[i].deque.bottom, 0);
+    }
+    for (unsigned i = 0; i < shares; ++i)
+        Pool_push(&pool->workers[i].deque, blocks * i / shares << 32 | blocks * (i + 1) / shares);
+    pool->busy = pool->threads;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->wake);
+
+    clock_gettime(CLOCK_REALTIME, &wake);
+    while (pool->busy)
+    {
+        ++wake.tv_sec;
+        if (pthread_cond_timedwait(&pool->done, &pool->lock, &wake) == ETIMEDOUT && job->progress)
+            job->progress(job->context);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Corpus file is a header, then fixed-size records in the order they were
+ * generated and then, for every metric, keys of all records sorted by it.
+ */
+#define Corpus_MAGIC "MSWCRP06"
+#define Corpus_BATCH 4096
+
+struct Corpus_Header
+{
+    char magic[8];
+    uint32_t width, height, depth, mines, generator, wrap, topology, most;
+    uint64_t count;
+};
+
+struct Corpus_Record
+{
+    uint32_t seed;
+    uint32_t metrics[Field_Metric_COUNT];
+};
+
+struct Corpus_Key
+{
+    uint32_t metric, record;
+};
+
+struct Corpus_Worker
+{
+    struct Field field;
+    struct Corpus_Record *records;
+};
+
+struct Corpus
+{
+    struct Corpus_Header header;
+    unsigned first_seed;
+    FILE *file;
+    pthread_mutex_t lock;
+    uint64_t written;
+    uint32_t *metrics[Field_Metric_COUNT];
+    int error;
+    struct Corpus_Worker *workers;
+};
+
+void Corpus_measure(struct Field *field, unsigned seed, unsigned mines, enum Field_Generator generator, struct Corpus_Record *record)
+{
+    struct Random random;
+
+    memset(field->field, 0, Field_cells(field) * sizeof(*field->field));
+    Field_seed(field, mines, seed, generator, &random);
+
+    record->seed = seed;
+    Field_measure(field, record->metrics);
+}
+
+/* A block of the pool is at most Corpus_BATCH records */
+int Corpus_work(void *context, unsigned worker, uint64_t first, uint64_t last)
+{
+    struct Corpus *corpus = context;
+    struct Corpus_Worker *own = corpus->workers + worker;
+    unsigned count = last - first;
+    uint64_t base;
+    int error;
+
+    for (unsigned i = 0; i < count; ++i)
+        Corpus_measure(&own->field, corpus->first_seed + first + i, corpus->header.mines, corpus->header.generator, own->records + i);
+
+    pthread_mutex_lock(&corpus->lock);
+    base = corpus->written;
+    if (fwrite(own->records, sizeof(*own->records), count, corpus->file) != count)
+        corpus->error = 1;
+    corpus->written += count;
+    error = corpus->error;
+    pthread_mutex_unlock(&corpus->lock);
+
+    for (unsigned i = 0; i < count; ++i)
+        for (int m = 0; m < Field_Metric_COUNT; ++m)
+            corpus->metrics[m][base + i] = own->records[i].metrics[m];
+    return !error;
+}
+
+int Corpus_index(struct Corpus *corpus, enum Field_Metric metric)
+{
+    uint32_t *metrics = corpus->metrics[metric];
+    uint64_t bound = (uint64_t)corpus->header.width * corpus->header.height * corpus->header.depth + 1;
+    uint64_t *histogram;
+    struct Corpus_Key *keys;
+
+    histogram = calloc(bound + 1, sizeof(*histogram));
+    keys = malloc(corpus->header.count * sizeof(*keys));
+    if (!histogram || !keys)
+    {
+        free(histogram);
+        free(keys);
+        return -1;
+    }
+
+    /* metrics are bounded by the field size, so counting sort does it */
+    for (uint64_t i = 0; i < corpus->header.count; ++i)
+        ++histogram[metrics[i] + 1];
+    for (uint64_t i = 1; i <= bound; ++i)
+        histogram[i] += histogram[i - 1];
+    for (uint64_t i = 0; i < corpus->header.count; ++i)
+        keys[histogram[metrics[i]]++] = (struct Corpus_Key){.metric=metrics[i], .record=i};
+
+    int ret = fwrite(keys, sizeof(*keys), corpus->header.count, corpus->file) == corpus->header.count
+        ? 0
+        : -1;
+
+    free(histogram);
+    free(keys);
+    return ret;
+}
+
+int Corpus_create(const char *path, unsigned width, unsigned height, unsigned depth, int wrap, enum Field_Topology topology, unsigned most, unsigned mines, enum Field_Generator generator, unsigned first_seed, uint64_t count, struct Pool *pool)
+{
+    struct Corpus corpus = {
+        .header = {Corpus_MAGIC, width, height, depth, mines, generator, wrap, topology, most, count},
+        .first_seed = first_seed,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    struct Pool_Job job = {Corpus_work, NULL, &corpus, count, Corpus_BATCH};
+
+    if (!(corpus.workers = calloc(pool->threads, sizeof(*corpus.workers))))
+        err(1, "calloc()");
+    for (unsigned i = 0; i < pool->threads; ++i)
+    {
+        struct Corpus_Worker *worker = corpus.workers + i;
+
+        worker->field = (struct Field){width, height, depth};
+        Field_init(&worker->field, wrap, topology, most);
+        if (!(worker->field.field = malloc(Field_cells(&worker->field) * sizeof(*worker->field.field))))
+            err(1, "malloc()");
+        if (!(worker->records = malloc(Corpus_BATCH * sizeof(*worker->records))))
+            err(1, "malloc()");
+    }
+
+    for (int m = 0; m < Field_Metric_COUNT; ++m)
+        if (!(corpus.metrics[m] = malloc(count * sizeof(*corpus.metrics[m]))))
+            err(1, "malloc()");
+
+    if (!(corpus.file = fopen(path, "wb")))
+        err(1, "cannot open %s", path);
+    if (fwrite(&corpus.header, sizeof(corpus.header), 1, corpus.file) != 1)
+        err(1, "cannot write %s", path);
+
+    Pool_run(pool, &job);
+    for (unsigned i = 0; i < pool->threads; ++i)
+    {
+        free(corpus.workers[i].field.field);
+        free(corpus.workers[i].records);
+    }
+    free(corpus.workers);
+
+    if (corpus.error)
+        errx(1, "cannot generate %s", path);
+
+    for (int m = 0; m < Field_Metric_COUNT; ++m)
+    {
+        if (Corpus_index(&corpus, m) < 0)
+            err(1, "cannot index %s", path);
+        free(corpus.metrics[m]);
+    }
+    if (fclose(corpus.file))
+        err(1, "cannot write %s", path);
+
+    return 0;
+}
+
+void Corpus_print(const struct Corpus_Record *record)
+{
+    printf("%u", record->seed);
+    for (int m = 0; m < Field_Metric_COUNT; ++m)
+        printf(" %u", record->metrics[m]);
+    putchar('\n');
+}
+
+int Corpus_query(const char *path, unsigned width, unsigned height, unsigned depth, int wrap, enum Field_Topology topology, unsigned most, enum Field_Metric metric, uint32_t min, uint32_t max)
+{
+    const struct Corpus_Header *header;
+    const struct Corpus_Record *records;
+    const struct Corpus_Key *keys;
+    struct stat st;
+    uint64_t low, high;
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        err(1, "cannot open %s", path);
+    if (fstat(fd, &st) < 0)
+        err(1, "cannot stat %s", path);
+    if ((size_t)st.st_size < sizeof(*header))
+        errx(1, "%s is %s", path, "not a corpus");
+    if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        err(1, "cannot map %s", path);
+    close(fd);
+
+    header = map;
+    if (memcmp(header->magic, Corpus_MAGIC, sizeof(header->magic))
+        || (uint64_t)st.st_size != sizeof(*header)
+            + header->count * (sizeof(*records) + Field_Metric_COUNT * sizeof(*keys)))
+        errx(1, "%s is %s", path, "not a corpus");
+    if (header->width != width || header->height != height || header->depth != depth
+        || header->wrap != (uint32_t)wrap || header->topology != topology || header->most != most)
+        goto end;
+
+    records = (const struct Corpus_Record *)(header + 1);
+    keys = (const struct Corpus_Key *)(records + header->count) + metric * header->count;
+
+    for (low = 0, high = header->count; low < high;)
+    {
+        uint64_t middle = low + (high - low) / 2;
+        if (keys[middle].metric < min)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    for (; low < header->count && keys[low].metric <= max; ++low)
+        Corpus_print(records + keys[low].record);
+
+end:
+    munmap(map, st.st_size);
+    return 0;
+}
+
+/*
+ * Leaderboards keep the fastest won games of every kind of field. The
+ * file is a magic, then a table for every kind of field, each with its
+ * best Scores_TOP games sorted by time. Writers take a lock next to the
+ * file, merge their games into what was read, write a new file and rename
+ * it over the old one, so readers and crashes see either file whole.
+ */
+#define Scores_MAGIC "MSWLDB01"
+#define Scores_TOP 10
+
+struct Scores_Kind
+{
+    uint32_t width, height, depth, mines, wrap, topology, most, reserved;
+};
+
+struct Scores_Entry
+{
+    uint64_t microseconds;
+    uint32_t seed;
+    char name[12];
+};
+
+struct Scores_Top
+{
+    uint32_t count;
+    struct Scores_Entry entries[Scores_TOP];
+};
+
+struct Scores_Table
+{
+    struct Scores_Kind kind;
+    struct Scores_Top top;
+};
+
+/* Returns whether the game is one of the best */
+int Scores_insert(struct Scores_Top *top, const struct Scores_Entry *entry)
+{
+    unsigned i = top->count < Scores_TOP ? top->count++ : Scores_TOP;
+
+    for (; i > 0 && top->entries[i - 1].microseconds > entry->microseconds; --i)
+        if (i < Scores_TOP)
+            top->entries[i] = top->entries[i - 1];
+    if (i == Scores_TOP)
+        return 0;
+    top->entries[i] = *entry;
+    return 1;
+}
+
+void Scores_print(const struct Scores_Top *top, FILE *out)
+{
+    for (unsigned i = 0; i < top->count; ++i)
+        fprintf(
+            out,
+            "%2u. %" PRIu64 ".%03" PRIu64 " s %-12.12s seed %" PRIu32 "\n",
+            i + 1,
+            top->entries[i].microseconds / 1000000,
+            top->entries[i].microseconds / 1000 % 1000,
+            top->entries[i].name,
+            top->entries[i].seed
+        );
+}
+
+/* Merges the games into the table of their kind, which is left in top */
+int Scores_record(const char *path, const struct Scores_Kind *kind, struct Scores_Top *top)
+{
+    char lock[PATH_MAX], temporary[PATH_MAX], magic[8];
+    struct Scores_Table *tables = NULL, *table = NULL;
+    size_t count = 0;
+    FILE *file;
+    int fd, ret = -1;
+
+    if ((size_t)snprintf(lock, sizeof(lock), "%s.lock", path) >= sizeof(lock)
+        || (size_t)snprintf(temporary, sizeof(temporary), "%s.new", path) >= sizeof(temporary))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if ((fd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+        return -1;
+    if (flock(fd, LOCK_EX) < 0)
+        goto end;
+
+    if ((file = fopen(path, "rb")))
+    {
+        struct stat st;
+
+        if (fstat(fileno(file), &st) < 0
+            || st.st_size < (off_t)sizeof(magic)
+            || (st.st_size - sizeof(magic)) % sizeof(*tables)
+            || fread(magic, sizeof(magic), 1, file) != 1
+            || memcmp(magic, Scores_MAGIC, sizeof(magic)))
+        {
+            fclose(file);
+            errno = EINVAL;
+            goto end;
+        }
+        count = (st.st_size - sizeof(magic)) / sizeof(*tables);
+        if (!(tables = malloc((count + 1) * sizeof(*tables)))
+            || fread(tables, sizeof(*tables), count, file) != count)
+        {
+            fclose(file);
+            goto end;
+        }
+        fclose(file);
+    }
+    else if (errno != ENOENT || !(tables = malloc(sizeof(*tables))))
+    {
+        goto end;
+    }
+
+    for (size_t i = 0; !table && i < count; ++i)
+        if (!memcmp(&tables[i].kind, kind, sizeof(*kind)))
+            table = tables + i;
+    if (!table)
+    {
+        table = tables + count++;
+        *table = (struct Scores_Table){.kind = *kind};
+    }
+    for (unsigned i = 0; i < top->count; ++i)
+        Scores_insert(&table->top, top->entries + i);
+    *top = table->top;
+
+    if (!(file = fopen(temporary, "wb")))
+        goto end;
+    if (fwrite(Scores_MAGIC, sizeof(magic), 1, file) != 1
+        || fwrite(tables, sizeof(*tables), count, file) != count
+        || fflush(file) == EOF
+        || fsync(fileno(file)) < 0)
+    {
+        fclose(file);
+        unlink(temporary);
+        goto end;
+    }
+    if (fclose(file) == EOF || rename(temporary, path) < 0)
+    {
+        unlink(temporary);
+        goto end;
+    }
+    ret = 0;
+
+end:
+    free(tables);
+    close(fd);
+    return ret;
+}
+
+/*
+ * Every batch thread owns its shard of statistics, so nothing is shared on
+ * the hot path. Counters shown in progress are written only by the owner
+ * and read relaxed by the reporter, histograms are read after the join.
+ */
+#define Stats_MOVES 16
+#define Stats_TIMES 32
+#define Batch_GRAIN 64
+
+struct Stats
+{
+    _Alignas(64) _Atomic uint64_t games, won;
+    uint64_t moves[Stats_MOVES];
+    uint64_t times[Stats_TIMES];
+    uint64_t nanoseconds;
+    struct Scores_Top top;
+};
+
+void Stats_bump(_Atomic uint64_t *counter)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+uint64_t Stats_nanoseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void Stats_merge(struct Stats *to, struct Stats *from)
+{
+    atomic_store(&to->games, atomic_load(&to->games) + atomic_load(&from->games));
+    atomic_store(&to->won, atomic_load(&to->won) + atomic_load(&from->won));
+    for (int i = 0; i < Stats_MOVES; ++i)
+        to->moves[i] += from->moves[i];
+    for (int i = 0; i < Stats_TIMES; ++i)
+        to->times[i] += from->times[i];
+    to->nanoseconds += from->nanoseconds;
+    for (unsigned i = 0; i < from->top.count; ++i)
+        Scores_insert(&to->top, from->top.entries + i);
+}
+
+void Stats_print(struct Stats *stats, unsigned cells)
+{
+    uint64_t games = atomic_load(&stats->games), won = atomic_load(&stats->won);
+    unsigned step = cells / Stats_MOVES + 1;
+
+    printf("games %" PRIu64 "\n", games);
+    printf("won %" PRIu64 " (%.2f%%)\n", won, games ? 100. * won / games : 0.);
+    printf("lost %" PRIu64 "\n", games - won);
+    printf("time per game %.3f us\n", games ? stats->nanoseconds / 1000. / games : 0.);
+
+    printf("moves per game\n");
+    for (int i = 0; i < Stats_MOVES; ++i)
+        if (stats->moves[i])
+            printf("  %u-%u %" PRIu64 "\n", i * step, (i + 1) * step - 1, stats->moves[i]);
+
+    printf("time per game\n");
+    for (int i = 0; i < Stats_TIMES; ++i)
+        if (stats->times[i])
+            printf("  <%" PRIu64 " ns %" PRIu64 "\n", (uint64_t)2 << i, stats->times[i]);
+}
+
+struct Batch
+{
+    unsigned width, height, depth, mines, first_seed;
+    int wrap;
+    enum Field_Topology topology;
+    unsigned most;
+    enum Field_Generator generator;
+    uint64_t count;
+    struct Batch_Worker *workers;
+    unsigned threads;
+};
+
+struct Batch_Worker
+{
+    struct Stats stats;
+    struct Field field;
+};
+
+int Batch_work(void *context, unsigned worker, uint64_t first, uint64_t last)
+{
+    struct Batch *batch = context;
+    struct Stats *stats = &batch->workers[worker].stats;
+    struct Field *field = &batch->workers[worker].field;
+    unsigned cells = Field_cells(field), moves;
+    struct Random random;
+    uint64_t start, took;
+    unsigned bucket;
+    int win;
+
+    for (uint64_t i = first; i < last; ++i)
+    {
+        start = Stats_nanoseconds();
+
+        memset(field->field, 0, cells * sizeof(*field->field));
+        Field_seed(field, batch->mines, batch->first_seed + i, batch->generator, &random);
+        win = Solver_play(field, &random, &moves);
+
+        took = Stats_nanoseconds() - start;
+        bucket = took ? 63 - __builtin_clzll(took) : 0;
+        stats->nanoseconds += took;
+        ++stats->times[bucket < Stats_TIMES ? bucket : Stats_TIMES - 1];
+        ++stats->moves[moves / (cells / Stats_MOVES + 1)];
+        if (win > 0)
+        {
+            Stats_bump(&stats->won);
+            Scores_insert(&stats->top, &(struct Scores_Entry){took / 1000, batch->first_seed + i, "solver"});
+        }
+        Stats_bump(&stats->games);
+    }
+    return 1;
+}
+
+void Batch_progress(void *context)
+{
+    struct Batch *batch = context;
+    uint64_t games = 0, won = 0;
+
+    for (unsigned i = 0; i < batch->threads; ++i)
+    {
+        games += atomic_load_explicit(&batch->workers[i].stats.games, memory_order_relaxed);
+        won += atomic_load_explicit(&batch->workers[i].stats.won, memory_order_relaxed);
+    }
+    fprintf(stderr, "%" PRIu64 "/%" PRIu64 " games, %" PRIu64 " won\n", games, batch->count, won);
+}
+
+int Batch_run(unsigned width, unsigned height, unsigned depth, int wrap, enum Field_Topology topology, unsigned most, unsigned mines, enum Field_Generator generator, unsigned first_seed, uint64_t count, struct Pool *pool, const char *scores)
+{
+    struct Batch batch = {width, height, depth, mines, first_seed, wrap, topology, most, generator, count};
+    struct Pool_Job job = {Batch_work, Batch_progress, &batch, count, Batch_GRAIN};
+    struct Batch_Worker *workers;
+    struct Stats total = {0};
+
+    if (!(workers = aligned_alloc(_Alignof(struct Batch_Worker), pool->threads * sizeof(*workers))))
+        err(1, "aligned_alloc()");
+    memset(workers, 0, pool->threads * sizeof(*workers));
+    batch.workers = workers;
+    batch.threads = pool->threads;
+
+    for (unsigned i = 0; i < pool->threads; ++i)
+    {
+        workers[i].field = (struct Field){width, height, depth};
+        Field_init(&workers[i].field, wrap, topology, most);
+        if (!(workers[i].field.field = malloc(Field_cells(&workers[i].field) * sizeof(*workers[i].field.field))))
+            err(1, "malloc()");
+    }
+
+    Pool_run(pool, &job);
+
+    for (unsigned i = 0; i < pool->threads; ++i)
+    {
+        Stats_merge(&total, &workers[i].stats);
+        free(workers[i].field.field);
+    }
+    free(workers);
+
+    Stats_print(&total, width * height * depth);
+    if (scores)
+    {
+        struct Scores_Kind kind = {width, height, depth, mines, wrap, topology, most, 0};
+
+        if (Scores_record(scores, &kind, &total.top) < 0)
+            err(1, "cannot record scores in %s", scores);
+        printf("best games\n");
+        Scores_print(&total.top, stdout);
+    }
+    return 0;
+}
+
+/*
+ * Opens random cells of one field from many threads at once and shows how
+ * often a tile was found locked, to see how the tiles hold up against the
+ * amount of threads and the size of the cascades.
+ */
+#define Reveal_GRAIN 1024
+
+struct Reveal_Worker
+{
+    _Alignas(64) uint64_t opens, opened;
+};
+
+struct Reveal
+{
+    struct Field *field;
+    struct Field_Tiles tiles;
+    unsigned seed;
+    struct Reveal_Worker *workers;
+};
+
+/* Cells of a block come from its own seed, so they do not depend on jobs */
+int Reveal_work(void *context, unsigned worker, uint64_t first, uint64_t last)
+{
+    struct Reveal *reveal = context;
+    struct Reveal_Worker *own = reveal->workers + worker;
+    struct Field *field = reveal->field;
+    struct Random random;
+    unsigned x, y, z;
+
+    Random_seed(&random, reveal->seed + first / Reveal_GRAIN + 1);
+    for (uint64_t i = first; i < last; ++i)
+    {
+        x = Random_next(&random) % field->width;
+        y = Random_next(&random) % field->height;
+        z = Random_next(&random) % field->depth;
+        own->opened += Field_openShared(field, &reveal->tiles, x, y, z);
+        ++own->opens;
+    }
+    return 1;
+}
+
+int Reveal_run(unsigned width, unsigned height, unsigned depth, int wrap, enum Field_Topology topology, unsigned most, unsigned mines, enum Field_Generator generator, unsigned seed, uint64_t count, struct Pool *pool)
+{
+    struct Field field = {width, height, depth};
+    struct Reveal reveal = {&field, .seed = seed};
+    struct Pool_Job job = {Reveal_work, NULL, &reveal, count, Reveal_GRAIN};
+    struct Random random;
+    uint64_t start, took, opens = 0, opened = 0, locks = 0, waits = 0;
+
+    Field_init(&field, wrap, topology, most);
+    if (!(field.field = calloc(Field_cells(&field), sizeof(*field.field))))
+        err(1, "calloc()");
+    Field_seed(&field, mines, seed, generator, &random);
+    if (Field_Tiles_init(&reveal.tiles, &field) < 0)
+        err(1, "aligned_alloc()");
+    if (!(reveal.workers = aligned_alloc(_Alignof(struct Reveal_Worker), pool->threads * sizeof(*reveal.workers))))
+        err(1, "aligned_alloc()");
+    memset(reveal.workers, 0, pool->threads * sizeof(*reveal.workers));
+
+    start = Stats_nanoseconds();
+    Pool_run(pool, &job);
+    for (unsigned i = 0; i < pool->threads; ++i)
+    {
+        opens += reveal.workers[i].opens;
+        opened += reveal.workers[i].opened;
+    }
+    took = Stats_nanoseconds() - start;
+    for (unsigned t = 0; t < reveal.tiles.count; ++t)
+    {
+        locks += reveal.tiles.tiles[t].locks;
+        waits += reveal.tiles.tiles[t].waits;
+    }
+
+    printf("threads %u\n", pool->threads);
+    printf("tiles %u of %u cells\n", reveal.tiles.count, Field_TILE_CELLS);
+    printf("opens %" PRIu64 "\n", opens);
+    printf("opened %" PRIu64 " of %u cells\n", opened, Field_cells(&field));
+    printf("time per open %.3f us\n", opens ? took / 1000. / opens : 0.);
+    printf("locks %" PRIu64 ", %.2f per open\n", locks, opens ? (double)locks / opens : 0.);
+    printf("waits %" PRIu64 " (%.2f%%)\n", waits, locks ? 100. * waits / locks : 0.);
+
+    free(reveal.workers);
+    Field_Tiles_free(&reveal.tiles);
+    free(field.field);
+    return 0;
+}
+
+/*
+ * Scans seeds for fields matching all the ranges. Mines are placed one by
+ * one so a field is dropped as soon as one lands near the first click of a
+ * no-guess search, and the solver runs only on fields that passed the rest.
+ *
+ * Given a known field, which is a cell count, Search_MINE or Search_UNKNOWN
+ * for every cell, the search recovers its seed. The first mines are checked
+ * straight from the seed against known safe cells, which drops most seeds.
+ */
+#define Search_GRAIN 256
+#define Search_MINE -1
+#define Search_UNKNOWN -2
+
+struct Search
+{
+    unsigned width, height, depth, mines, first_seed;
+    int wrap;
+    enum Field_Topology topology;
+    unsigned most;
+    uint64_t count;
+    uint32_t ranges[Field_Metric_COUNT][2];
+    enum Field_Generator generator;
+    int no_guess, all;
+    const signed char *known;
+    struct Random_Early early;
+    _Atomic uint64_t found;
+    struct Corpus_Record record;
+    pthread_mutex_t lock;
+    struct Search_Worker *workers;
+};
+
+struct Search_Worker
+{
+    struct Field field, window;
+    uint64_t checked;
+};
+
+/*
+ * Opens the first click in a window of a shuffled field growing it until
+ * the opening fits or is too large, so most fields are dropped after
+ * generating only a few cells of them.
+ */
+int Search_click(struct Search *search, const struct Field *shape, const struct Shuffle *shuffle, struct Field *window)
+{
+    unsigned reach = shape->topology->reach, opened, leaked;
+
+    for (unsigned side = 4;; side *= 2)
+    {
+        window->width = side < search->width ? side : search->width;
+        window->height = side < search->height ? side : search->height;
+        window->depth = 1;
+        Field_init(window, 0, search->topology, search->most);
+        memset(window->field, 0, window->width * window->height * sizeof(*window->field));
+        Field_generateWindow(window, 0, 0, shape, search->mines, shuffle);
+
+        struct Field_Cell c = window->field[0];
+        if (search->no_guess && (c.is_mine || c.mines_near))
+            return 0;
+        opened = c.is_mine ? 0 : Field_open(window, 0, 0, 0);
+        if (opened > search->ranges[Field_Metric_CLICK][1])
+            return 0;
+
+        /* an empty cell opened in reach of the window edge means it goes on */
+        leaked = 0;
+        for (unsigned y = 0; y < window->height; ++y)
+        {
+            for (unsigned x = 0; x < window->width; ++x)
+            {
+                if ((x + reach < window->width || window->width == search->width)
+                    && (y + reach < window->height || window->height == search->height))
+                    continue;
+                leaked |= window->field[x + y * window->width].status == Field_Cell_Status_OPENED
+                    && !window->field[x + y * window->width].mines_near;
+            }
+        }
+        if (!leaked)
+            return opened >= search->ranges[Field_Metric_CLICK][0];
+    }
+}
+
+signed char *Search_load(const char *path, const struct Field *shape)
+{
+    unsigned width = shape->width, height = shape->height, y, shift;
+    signed char *known;
+    char *line = NULL;
+    size_t size = 0;
+    FILE *file;
+
+    if (!(file = fopen(path, "r")))
+        err(1, "cannot open %s", path);
+    if (!(known = malloc(width * height)))
+        err(1, "malloc()");
+
+    /* same as shown by the game, hidden and flagged cells are unknown */
+    for (y = 0; y < height && getline(&line, &size, file) >= 0; ++y)
+    {
+        shift = y & shape->topology->parity;
+        if (strcspn(line, "\n") != 2 * width + shift)
+            errx(1, "%s: line %u is not %u cells long", path, y + 1, width);
+        for (unsigned x = 0; x < width; ++x)
+        {
+            char c = line[2 * x + 1 + shift];
+            known[x + y * width] = c == '#'
+                ? Search_MINE
+                : isdigit(c)
+                    ? c - '0'
+                    : Search_UNKNOWN;
+        }
+    }
+    if (y < height)
+        errx(1, "%s: has less than %u lines", path, height);
+    free(line);
+    fclose(file);
+
+    return known;
+}
+
+int Search_early(struct Search *search, unsigned seed)
+{
+    unsigned mines = search->mines < Random_EARLY / 2 ? search->mines : Random_EARLY / 2;
+    unsigned drawn[Random_EARLY / 2], x, y;
+    uint32_t words[Random_DEGREE];
+    struct Shuffle shuffle;
+
+    switch (search->generator)
+    {
+    case Field_Generator_RANDOM:
+    {
+        Random_words(words, seed);
+        for (unsigned k = 0; k < mines; ++k)
+        {
+            x = Random_early(&search->early, words, 2 * k) % search->width;
+            y = Random_early(&search->early, words, 2 * k + 1) % search->height;
+            drawn[k] = x + y * search->width;
+
+            /* a taken cell is drawn again, so the rest is not known */
+            for (unsigned j = 0; j < k; ++j)
+                if (drawn[j] == drawn[k])
+                    return 1;
+            if (search->known[drawn[k]] >= 0)
+                return 0;
+        }
+    } break;
+    case Field_Generator_SHUFFLE:
+    {
+        Shuffle_init(&shuffle, search->width * search->height * search->depth, seed);
+        for (unsigned k = 0; k < mines; ++k)
+            if (search->known[Shuffle_forward(&shuffle, k)] >= 0)
+                return 0;
+    } break;
+    }
+
+    return 1;
+}
+
+/* The window is also where the field is backed up */
+int Search_match(struct Search *search, struct Field *field, struct Field *window, unsigned seed, struct Corpus_Record *record)
+{
+    struct Field_Cell *backup = window->field;
+    unsigned cells = Field_cells(field), i;
+    struct Shuffle shuffle;
+    struct Random random;
+
+    if (search->known && !Search_early(search, seed))
+        return 0;
+
+    memset(field->field, 0, cells * sizeof(*field->field));
+    switch (search->generator)
+    {
+    case Field_Generator_RANDOM:
+    {
+        Random_seed(&random, seed);
+        for (unsigned mines = search->mines; mines > 0; --mines)
+        {
+            i = Field_place(field, &random);
+            if (search->no_guess && Field_isNear(field, 0, 0, 0, i))
+                return 0;
+            if (search->known && search->known[i] >= 0)
+                return 0;
+        }
+    } break;
+    case Field_Generator_SHUFFLE:
+    {
+        Shuffle_init(&shuffle, cells * search->most, seed);
+        /* a torus has no window to stop at, so it is measured whole */
+        if (!search->wrap && search->depth == 1
+            && (search->no_guess || search->ranges[Field_Metric_CLICK][0] > 0 || search->ranges[Field_Metric_CLICK][1] < UINT32_MAX)
+            && !Search_click(search, field, &shuffle, window))
+            return 0;
+        Field_shuffle(field, search->mines, &shuffle);
+    } break;
+    }
+
+    for (i = 0; search->known && i < cells; ++i)
+    {
+        if (search->known[i] == Search_UNKNOWN)
+            continue;
+        if (search->known[i] == Search_MINE
+            ? !field->field[i].is_mine
+            : field->field[i].is_mine || field->field[i].mines_near != search->known[i])
+            return 0;
+    }
+
+    if (search->no_guess)
+        memcpy(backup, field->field, cells * sizeof(*field->field));
+
+    record->seed = seed;
+    Field_measure(field, record->metrics);
+    for (int m = 0; m < Field_Metric_COUNT; ++m)
+        if (record->metrics[m] < search->ranges[m][0] || record->metrics[m] > search->ranges[m][1])
+            return 0;
+
+    if (search->no_guess)
+    {
+        memcpy(field->field, backup, cells * sizeof(*field->field));
+        return Solver_solve(field, 0, 0, 0);
+    }
+
+    return 1;
+}
+
+int Search_work(void *context, unsigned worker, uint64_t first, uint64_t last)
+{
+    struct Search *search = context;
+    struct Search_Worker *own = search->workers + worker;
+    struct Corpus_Record record;
+    uint64_t found;
+
+    for (uint64_t i = first; i < last && i < atomic_load(&search->found); ++i)
+    {
+        ++own->checked;
+        if (!Search_match(search, &own->field, &own->window, search->first_seed + i, &record))
+            continue;
+
+        pthread_mutex_lock(&search->lock);
+        if (search->all)
+        {
+            Corpus_print(&record);
+        }
+        else
+        {
+            /* keep the lowest one, so the answer does not depend on jobs */
+            found = atomic_load(&search->found);
+            while (i < found && !atomic_compare_exchange_weak(&search->found, &found, i));
+            if (atomic_load(&search->found) == i)
+                search->record = record;
+        }
+        pthread_mutex_unlock(&search->lock);
+
+        if (!search->all)
+            break;
+    }
+    return 1;
+}
+
+int Search_run(struct Search *search, struct Pool *pool)
+{
+    struct Pool_Job job = {Search_work, NULL, search, search->count, Search_GRAIN, &search->found};
+    uint64_t start = Stats_nanoseconds(), checked = 0;
+    double took;
+
+    atomic_init(&search->found, search->count);
+    pthread_mutex_init(&search->lock, NULL);
+    Random_earlyInit(&search->early);
+
+    if (!(search->workers = calloc(pool->threads, sizeof(*search->workers))))
+        err(1, "calloc()");
+    for (unsigned i = 0; i < pool->threads; ++i)
+    {
+        struct Search_Worker *worker = search->workers + i;
+        unsigned cells = search->width * search->height * search->depth;
+
+        worker->field = (struct Field){search->width, search->height, search->depth};
+        Field_init(&worker->field, search->wrap, search->topology, search->most);
+        if (!(worker->field.field = malloc(cells * sizeof(*worker->field.field)))
+            || !(worker->window.field = malloc(cells * sizeof(*worker->window.field))))
+            err(1, "malloc()");
+    }
+
+    Pool_run(pool, &job);
+    for (unsigned i = 0; i < pool->threads; ++i)
+    {
+        checked += search->workers[i].checked;
+        free(search->workers[i].field.field);
+        free(search->workers[i].window.field);
+    }
+    free(search->workers);
+
+    took = (Stats_nanoseconds() - start) / 1e9;
+    warnx("checked %" PRIu64 " seeds in %.3f s, %.0f seeds/s", checked, took, checked / took);
+
+    if (search->all)
+        return 0;
+    if (atomic_load(&search->found) == search->count)
+    {
+        warnx("no seed found");
+        return 1;
+    }
+
+    Corpus_print(&search->record);
+    return 0;
+}
+
+const char *const Player_Move_Action_CHARS =
+    "@"
+    "!"
+    "<"
+    "j"
+    "?"
+    ">"
+    "h"
+    "#"
+    "r"
+    "l"
+    "u"
+    "k"
+;
+
+enum Player_Move_Action
+{
+    Player_Move_Action_CLICK_OPEN,
+    Player_Move_Action_CLICK_FLAG,
+    Player_Move_Action_BACK,
+    Player_Move_Action_DOWN,
+    Player_Move_Action_FLAG,
+    Player_Move_Action_FORTH,
+    Player_Move_Action_LEFT,
+    Player_Move_Action_OPEN,
+    Player_Move_Action_REDO,
+    Player_Move_Action_RIGHT,
+    Player_Move_Action_UNDO,
+    Player_Move_Action_UP,
+    /* input ended, cleanly or not, and there are no more moves */
+    Player_Move_Action_END,
+    Player_Move_Action_ERROR,
+};
+
+/* Digits past this are ignored, so steps added to a cell do not overflow */
+#define Player_NUMBER_MAX 999999999
+
+struct Player_Move
+{
+    int x, y, z;
+    enum Player_Move_Action action;
+};
+
+/*
+ * Reads moves a character at a time, so input can stop in the middle of a
+ * move and go on later. Numbers end with ';', the cell of an opening or a
+ * flag has its coordinates split by 'x' and its depth is optional.
+ */
+enum Player_Parser_Part
+{
+    Player_Parser_Part_ACTION,
+    Player_Parser_Part_X,
+    Player_Parser_Part_Y,
+    Player_Parser_Part_Z,
+};
+
+struct Player_Parser
+{
+    struct Player_Move move;
+    enum Player_Parser_Part part;
+};
+
+/* Returns 1 if the character ended a move */
+int Player_parse(struct Player_Parser *parser, int ch, struct Player_Move *move)
+{
+    struct Player_Move *next = &parser->move;
+    const char *actionp;
+    int cell, *number;
+
+    switch (parser->part)
+    {
+    case Player_Parser_Part_ACTION:
+    {
+        if (!ch || !(actionp = strchr(Player_Move_Action_CHARS, ch)))
+            return 0;
+        *next = (struct Player_Move){.action = actionp - Player_Move_Action_CHARS};
+
+        switch (next->action)
+        {
+        case Player_Move_Action_FLAG:
+        case Player_Move_Action_OPEN:
+        case Player_Move_Action_LEFT:
+        case Player_Move_Action_RIGHT:
+            parser->part = Player_Parser_Part_X;
+            return 0;
+        case Player_Move_Action_UP:
+        case Player_Move_Action_DOWN:
+            parser->part = Player_Parser_Part_Y;
+            return 0;
+        case Player_Move_Action_BACK:
+        case Player_Move_Action_FORTH:
+            parser->part = Player_Parser_Part_Z;
+            return 0;
+        default:
+            *move = *next;
+            return 1;
+        }
+    }
+    case Player_Parser_Part_X:
+        number = &next->x;
+        break;
+    case Player_Parser_Part_Y:
+        number = &next->y;
+        break;
+    case Player_Parser_Part_Z:
+    default:
+        number = &next->z;
+        break;
+    }
+
+    if (isdigit(ch))
+    {
+        if (*number <= Player_NUMBER_MAX / 10)
+            *number = *number * 10 + ch - '0';
+        return 0;
+    }
+
+    cell = next->action == Player_Move_Action_OPEN || next->action == Player_Move_Action_FLAG;
+    if (cell && ch == 'x' && parser->part != Player_Parser_Part_Z)
+    {
+        ++parser->part;
+        return 0;
+    }
+    if (ch != ';' || (cell && parser->part == Player_Parser_Part_X))
+        return 0;
+
+    /* depth is 1 if not given */
+    if (cell)
+    {
+        next->x -= 1;
+        next->y -= 1;
+        next->z -= parser->part == Player_Parser_Part_Z;
+    }
+    parser->part = Player_Parser_Part_ACTION;
+    *move = *next;
+    return 1;
+}
+
+/* A move that is cut by the end of input is not made */
+struct Player_Move Player_process(FILE *input)
+{
+    struct Player_Parser parser = {0};
+    struct Player_Move move;
+    int ch;
+
+    while ((ch = getc(input)) >= 0)
+        if (Player_parse(&parser, ch, &move))
+            return move;
+    return (struct Player_Move){.action=ferror(input) ? Player_Move_Action_ERROR : Player_Move_Action_END};
+}
+
+/*
+ * Moves of a timed game. Every move is its action, then microseconds
+ * since the move before and its arguments as numbers of 7 bits a byte,
+ * so a move usually takes 3 to 6 bytes. Writing a move reads the clock
+ * once and allocates only when the journal doubles.
+ */
+struct Journal
+{
+    unsigned char *bytes;
+    size_t used, size;
+    uint64_t start, last;
+    unsigned moves;
+};
+
+int Journal_put(struct Journal *journal, uint64_t value)
+{
+    if (journal->used + 10 > journal->size)
+    {
+        size_t size = journal->size ? journal->size * 2 : 256;
+        unsigned char *bytes;
+
+        if (!(bytes = realloc(journal->bytes, size)))
+            return -1;
+        journal->bytes = bytes;
+        journal->size = size;
+    }
+
+    do
+    {
+        journal->bytes[journal->used++] = (value & 0x7f) | (value > 0x7f) << 7;
+        value >>= 7;
+    } while (value);
+    return 0;
+}
+
+uint64_t Journal_get(const struct Journal *journal, size_t *at)
+{
+    uint64_t value = 0;
+    unsigned char byte;
+
+    for (unsigned shift = 0; *at < journal->used; shift += 7)
+    {
+        byte = journal->bytes[(*at)++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    return value;
+}
+
+/* The time is of when the move was read, the first one starts the clock */
+int Journal_write(struct Journal *journal, struct Player_Move move, uint64_t now)
+{
+    int arguments[3], count = 0;
+
+    switch (move.action)
+    {
+    case Player_Move_Action_OPEN:
+    case Player_Move_Action_FLAG:
+    {
+        arguments[count++] = move.x;
+        arguments[count++] = move.y;
+        arguments[count++] = move.z;
+    } break;
+    case Player_Move_Action_UP:
+    case Player_Move_Action_DOWN:
+    {
+        arguments[count++] = move.y;
+    } break;
+    case Player_Move_Action_LEFT:
+    case Player_Move_Action_RIGHT:
+    {
+        arguments[count++] = move.x;
+    } break;
+    case Player_Move_Action_BACK:
+    case Player_Move_Action_FORTH:
+    {
+        arguments[count++] = move.z;
+    } break;
+    default:
+        break;
+    }
+
+    if (!journal->moves++)
+        journal->start = journal->last = now;
+    if (Journal_put(journal, move.action) < 0 || Journal_put(journal, (now - journal->last) / 1000) < 0)
+        return -1;
+    journal->last = now;
+    for (int i = 0; i < count; ++i)
+        if (Journal_put(journal, arguments[i]) < 0)
+            return -1;
+    return 0;
+}
+
+void Journal_free(struct Journal *journal)
+{
+    free(journal->bytes);
+    *journal = (struct Journal){0};
+}
+
+/* Shows the total time, then every move as a command with its time */
+void Journal_print(const struct Journal *journal, const struct Field *field, FILE *out)
+{
+    struct Player_Move move = {0};
+    uint64_t took;
+    size_t at = 0;
+
+    fprintf(out, "Time is %.3f s for %u moves\n", (journal->last - journal->start) / 1e9, journal->moves);
+    while (at < journal->used)
+    {
+        move.action = Journal_get(journal, &at);
+        took = Journal_get(journal, &at);
+        fprintf(out, "  +%" PRIu64 ".%03" PRIu64 " s ", took / 1000000, took / 1000 % 1000);
+
+        switch (move.action)
+        {
+        case Player_Move_Action_OPEN:
+        case Player_Move_Action_FLAG:
+        {
+            move.x = Journal_get(journal, &at);
+            move.y = Journal_get(journal, &at);
+            move.z = Journal_get(journal, &at);
+            fprintf(out, "%c%dx%d", move.action == Player_Move_Action_OPEN ? '#' : '?', move.x + 1, move.y + 1);
+            if (field->depth > 1)
+                fprintf(out, "x%d", move.z + 1);
+            fprintf(out, ";\n");
+        } break;
+        case Player_Move_Action_UP:
+        case Player_Move_Action_DOWN:
+        case Player_Move_Action_LEFT:
+        case Player_Move_Action_RIGHT:
+        case Player_Move_Action_BACK:
+        case Player_Move_Action_FORTH:
+        {
+            fprintf(out, "%c%" PRIu64 ";\n", Player_Move_Action_CHARS[move.action], Journal_get(journal, &at));
+        } break;
+        default:
+        {
+            fprintf(out, "%c\n", Player_Move_Action_CHARS[move.action]);
+        } break;
+        }
+    }
+}
+
+/*
+ * Counters of games for -p. Every thread bumps its own shard, found by a
+ * thread-local pointer and put once on a list nothing is taken from, and
+ * a scrape sums the shards with relaxed loads, so counting takes no lock
+ * and shares no cache line. Times are counted in buckets by powers of 10
+ * from 1 us, as a Prometheus histogram without its sums of lower ones.
+ */
+#define Metrics_TIMES 7
+
+const char *const Metrics_ACTIONS[] = {
+    [Player_Move_Action_CLICK_OPEN] = "click_open",
+    [Player_Move_Action_CLICK_FLAG] = "click_flag",
+    [Player_Move_Action_BACK] = "back",
+    [Player_Move_Action_DOWN] = "down",
+    [Player_Move_Action_FLAG] = "flag",
+    [Player_Move_Action_FORTH] = "forth",
+    [Player_Move_Action_LEFT] = "left",
+    [Player_Move_Action_OPEN] = "open",
+    [Player_Move_Action_REDO] = "redo",
+    [Player_Move_Action_RIGHT] = "right",
+    [Player_Move_Action_UNDO] = "undo",
+    [Player_Move_Action_UP] = "up",
+};
+
+struct Metrics_Time
+{
+    _Atomic uint64_t buckets[Metrics_TIMES], nanoseconds;
+};
+
+struct Metrics
+{
+    _Alignas(64) _Atomic uint64_t started, won, lost;
+    _Atomic uint64_t moves[Player_Move_Action_END];
+    struct Metrics_Time generate, reveal;
+    /* of cells and dirty bytes of fields */
+    _Atomic uint64_t allocated, freed;
+    struct Metrics *next;
+};
+
+_Atomic(struct Metrics *) Metrics_shards;
+_Thread_local struct Metrics *Metrics_shard;
+const char *Metrics_path;
+
+struct Metrics *Metrics_local(void)
+{
+    struct Metrics *shard = Metrics_shard;
+
+    if (shard)
+        return shard;
+    if (!(shard = aligned_alloc(_Alignof(struct Metrics), sizeof(*shard))))
+        err(1, "aligned_alloc()");
+    memset(shard, 0, sizeof(*shard));
+    shard->next = atomic_load(&Metrics_shards);
+    while (!atomic_compare_exchange_weak(&Metrics_shards, &shard->next, shard));
+    return Metrics_shard = shard;
+}
+
+void Metrics_add(_Atomic uint64_t *counter, uint64_t amount)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+void Metrics_time(struct Metrics_Time *time, uint64_t nanoseconds)
+{
+    unsigned bucket = 0;
+
+    for (uint64_t bound = 1000; bucket < Metrics_TIMES - 1 && nanoseconds > bound; bound *= 10)
+        ++bucket;
+    Stats_bump(&time->buckets[bucket]);
+    Metrics_add(&time->nanoseconds, nanoseconds);
+}
+
+/* Sums the field of every shard at the offset */
+uint64_t Metrics_sum(size_t offset)
+{
+    uint64_t sum = 0;
+
+    for (struct Metrics *shard = atomic_load(&Metrics_shards); shard; shard = shard->next)
+        sum += atomic_load_explicit((_Atomic uint64_t *)((char *)shard + offset), memory_order_relaxed);
+    return sum;
+}
+
+void Metrics_printTime(FILE *out, const char *name, const char *help, size_t offset)
+{
+    uint64_t count = 0;
+    double bound = 1e-6;
+
+    fprintf(out, "# HELP minesweeper_%s_seconds %s\n# TYPE minesweeper_%s_seconds histogram\n", name, help, name);
+    for (unsigned i = 0; i < Metrics_TIMES; ++i, bound *= 10)
+    {
+        count += Metrics_sum(offset + offsetof(struct Metrics_Time, buckets) + i * sizeof(_Atomic uint64_t));
+        if (i < Metrics_TIMES - 1)
+            fprintf(out, "minesweeper_%s_seconds_bucket{le=\"%g\"} %" PRIu64 "\n", name, bound, count);
+        else
+            fprintf(out, "minesweeper_%s_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, count);
+    }
+    fprintf(out, "minesweeper_%s_seconds_sum %.9f\n", name, Metrics_sum(offset + offsetof(struct Metrics_Time, nanoseconds)) / 1e9);
+    fprintf(out, "minesweeper_%s_seconds_count %" PRIu64 "\n", name, count);
+}
+
+void Metrics_print(FILE *out)
+{
+    struct rusage usage;
+
+    fprintf(out, "# HELP minesweeper_games_started_total Games started.\n# TYPE minesweeper_games_started_total counter\n");
+    fprintf(out, "minesweeper_games_started_total %" PRIu64 "\n", Metrics_sum(offsetof(struct Metrics, started)));
+    fprintf(out, "# HELP minesweeper_games_won_total Games won, again if won after an undo.\n# TYPE minesweeper_games_won_total counter\n");
+    fprintf(out, "minesweeper_games_won_total %" PRIu64 "\n", Metrics_sum(offsetof(struct Metrics, won)));
+    fprintf(out, "# HELP minesweeper_games_lost_total Games lost, again if lost after an undo.\n# TYPE minesweeper_games_lost_total counter\n");
+    fprintf(out, "minesweeper_games_lost_total %" PRIu64 "\n", Metrics_sum(offsetof(struct Metrics, lost)));
+
+    fprintf(out, "# HELP minesweeper_moves_total Moves read, refused ones too.\n# TYPE minesweeper_moves_total counter\n");
+    for (unsigned i = 0; i < Player_Move_Action_END; ++i)
+        fprintf(out, "minesweeper_moves_total{action=\"%s\"} %" PRIu64 "\n", Metrics_ACTIONS[i], Metrics_sum(offsetof(struct Metrics, moves) + i * sizeof(_Atomic uint64_t)));
+
+    Metrics_printTime(out, "generation", "Time to place mines of a field.", offsetof(struct Metrics, generate));
+    Metrics_printTime(out, "reveal", "Time to open a cell and the cells it opens.", offsetof(struct Metrics, reveal));
+
+    fprintf(out, "# HELP minesweeper_field_bytes Memory held by cells of fields being played.\n# TYPE minesweeper_field_bytes gauge\n");
+    fprintf(out, "minesweeper_field_bytes %" PRIu64 "\n", Metrics_sum(offsetof(struct Metrics, allocated)) - Metrics_sum(offsetof(struct Metrics, freed)));
+    if (!getrusage(RUSAGE_SELF, &usage))
+    {
+        /* the resident size is in kilobytes */
+        fprintf(out, "# HELP minesweeper_resident_memory_max_bytes Most memory the process held.\n# TYPE minesweeper_resident_memory_max_bytes gauge\n");
+        fprintf(out, "minesweeper_resident_memory_max_bytes %" PRIu64 "\n", (uint64_t)usage.ru_maxrss * 1024);
+    }
+}
+
+/* Returns -1 if not all of it was written */
+int Metrics_write(int fd, const char *data, size_t size)
+{
+    ssize_t sent;
+
+    for (; size; data += sent, size -= sent)
+        if ((sent = write(fd, data, size)) < 0 && errno != EINTR)
+            return -1;
+        else if (sent < 0)
+            sent = 0;
+    return 0;
+}
+
+/* Answers every connection with the metrics as HTTP, whatever it asks */
+void *Metrics_thread(void *arg)
+{
+    int listener = *(int *)arg, fd, length;
+    struct timeval wait = {1, 0};
+    char request[4096], header[128], *body = NULL;
+    size_t size;
+    FILE *out;
+
+    for (;;)
+    {
+        if ((fd = accept(listener, NULL, NULL)) < 0)
+        {
+            /* out of descriptors or memory, which may pass */
+            if (errno != EINTR && errno != ECONNABORTED)
+            {
+                warn("cannot accept a metrics client");
+                sleep(1);
+            }
+            continue;
+        }
+
+        /* a client that says nothing gets them after a second, one that reads nothing is left */
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof(wait));
+        if (read(fd, request, sizeof(request)) < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            close(fd);
+            continue;
+        }
+        if (!(out = open_memstream(&body, &size)))
+        {
+            warn("open_memstream()");
+            close(fd);
+            continue;
+        }
+        Metrics_print(out);
+        if (fclose(out))
+            warn("cannot print the metrics");
+        else if ((length = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", size)) < 0
+            || Metrics_write(fd, header, length) < 0
+            || Metrics_write(fd, body, size) < 0)
+        {
+            if (errno != EPIPE && errno != ECONNRESET)
+                warn("cannot send the metrics");
+        }
+        free(body);
+        body = NULL;
+        close(fd);
+    }
+    return NULL;
+}
+
+void Metrics_unlink(void)
+{
+    unlink(Metrics_path);
+}
+
+/* Serves the metrics on the socket from a thread of their own */
+void Metrics_open(const char *path)
+{
+    static int listener;
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    pthread_t thread;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+        errx(1, "%s is %s", path, "too long for a socket");
+    memcpy(address.sun_path, path, strlen(path) + 1);
+    if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        err(1, "socket()");
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0)
+        err(1, "cannot bind %s", path);
+    Metrics_path = path;
+    atexit(Metrics_unlink);
+    if (listen(listener, SOMAXCONN) < 0)
+        err(1, "cannot listen on %s", path);
+
+    /* a metrics client may leave before it is answered */
+    signal(SIGPIPE, SIG_IGN);
+    if ((errno = pthread_create(&thread, NULL, Metrics_thread, &listener)) || (errno = pthread_detach(thread)))
+        err(1, "pthread_create()");
+}
+
+/*
+ * Spectators of the game played on the standard input. Every connection
+ * to the socket is answered with the field as it was between two moves,
+ * copied by Field_snapshot in a thread of its own, so the player never
+ * waits for them. The lock only keeps the field from going away.
+ */
+struct Watch
+{
+    /* the field played, or NULL when there is no game */
+    struct Field *field;
+    /* its shape with the copied cells, which are printed */
+    struct Field view;
+    pthread_mutex_t lock;
+    int listener;
+};
+
+const char *Watch_path;
+
+void Watch_print(struct Watch *watch, FILE *out)
+{
+    struct Field *view = &watch->view;
+    unsigned i = 0, last = Field_cells(view) - 1;
+    int win;
+
+    Field_snapshot(watch->field, view->field);
+    while (i < last && !view->field[i].is_selected)
+        ++i;
+    Field_print(view, i / view->width / view->height, out);
+    win = Field_isWin(view);
+    if (win > 0)
+        fprintf(out, "You won! UwU\n");
+    else if (win < 0)
+        fprintf(out, "You lost :<\n");
+    else if (view->depth > 1)
+        fprintf(out, "Your current location is (%u, %u, %u)\n", i % view->width + 1, i / view->width % view->height + 1, i / view->width / view->height + 1);
+    else
+        fprintf(out, "Your current location is (%u, %u)\n", i % view->width + 1, i / view->width + 1);
+}
+
+void *Watch_thread(void *arg)
+{
+    struct Watch *watch = arg;
+    struct timeval wait = {1, 0};
+    char *frame = NULL;
+    size_t size;
+    FILE *out;
+    int fd;
+
+    for (;;)
+    {
+        if ((fd = accept(watch->listener, NULL, NULL)) < 0)
+        {
+            if (errno != EINTR && errno != ECONNABORTED)
+            {
+                warn("cannot accept a spectator");
+                sleep(1);
+            }
+            continue;
+        }
+
+        /* a spectator that reads nothing is left */
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof(wait));
+        if (!(out = open_memstream(&frame, &size)))
+        {
+            warn("open_memstream()");
+            close(fd);
+            continue;
+        }
+        pthread_mutex_lock(&watch->lock);
+        if (watch->field)
+            Watch_print(watch, out);
+        pthread_mutex_unlock(&watch->lock);
+        if (fclose(out))
+            warn("cannot print the field");
+        else if (Metrics_write(fd, frame, size) < 0 && errno != EPIPE && errno != ECONNRESET)
+            warn("cannot send the field");
+        free(frame);
+        frame = NULL;
+        close(fd);
+    }
+    return NULL;
+}
+
+void Watch_unlink(void)
+{
+    unlink(Watch_path);
+}
+
+/* The field is only the shape, its game is given by Watch_set */
+void Watch_open(struct Watch *watch, const char *path, const struct Field *field)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    pthread_t thread;
+
+    *watch = (struct Watch){.lock = PTHREAD_MUTEX_INITIALIZER};
+    watch->view = *field;
+    watch->view.dirty = NULL;
+    if (!(watch->view.field = malloc(Field_cells(field) * sizeof(*watch->view.field))))
+        err(1, "malloc()");
+
+    if (strlen(path) >= sizeof(address.sun_path))
+        errx(1, "%s is %s", path, "too long for a socket");
+    memcpy(address.sun_path, path, strlen(path) + 1);
+    if ((watch->listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        err(1, "socket()");
+    if (bind(watch->listener, (struct sockaddr *)&address, sizeof(address)) < 0)
+        err(1, "cannot bind %s", path);
+    Watch_path = path;
+    atexit(Watch_unlink);
+    if (listen(watch->listener, SOMAXCONN) < 0)
+        err(1, "cannot listen on %s", path);
+
+    signal(SIGPIPE, SIG_IGN);
+    if ((errno = pthread_create(&thread, NULL, Watch_thread, watch)) || (errno = pthread_detach(thread)))
+        err(1, "pthread_create()");
+}
+
+/* A field is shown from when its cells are seeded until they are freed */
+void Watch_set(struct Watch *watch, struct Field *field)
+{
+    pthread_mutex_lock(&watch->lock);
+    watch->field = field;
+    pthread_mutex_unlock(&watch->lock);
+}
+
+/*
+ * A game of a player: the field with its history and the selected cell.
+ * Cells of moves are checked against the field, steps must not be negative.
+ */
+struct Game
+{
+    struct Field *field;
+    struct Field_History history;
+    int selected_x, selected_y, selected_z;
+    /* a game that went back is not a score */
+    int undone;
+    /* where refused moves are told, or NULL for the standard error */
+    FILE *errors;
+};
+
+void Game_warn(struct Game *game, const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    if (!game->errors)
+    {
+        vwarnx(format, ap);
+    }
+    else
+    {
+        vfprintf(game->errors, format, ap);
+        putc('\n', game->errors);
+    }
+    va_end(ap);
+}
+
+/* What cells and dirty bytes of the field take */
+size_t Game_bytes(const struct Field *field)
+{
+    return Field_cells(field) * sizeof(*field->field) + (Field_cells(field) + Field_CHUNK - 1) / Field_CHUNK;
+}
+
+/* The field must be initialised, its cells are allocated and seeded here */
+void Game_start(struct Game *game, struct Field *field, unsigned mines, unsigned seed, enum Field_Generator generator)
+{
+    struct Metrics *metrics = Metrics_local();
+    struct Random random;
+    uint64_t start;
+
+    *game = (struct Game){.field = field};
+    if (!(field->field = calloc(Field_cells(field), sizeof(*field->field))))
+        err(1, "calloc()");
+    if (!(field->dirty = calloc((Field_cells(field) + Field_CHUNK - 1) / Field_CHUNK, 1)))
+        err(1, "calloc()");
+    Metrics_add(&metrics->allocated, Game_bytes(field));
+
+    field->field[0].is_selected = 1;
+    start = Stats_nanoseconds();
+    Field_seed(field, mines, seed, generator, &random);
+    Metrics_time(&metrics->generate, Stats_nanoseconds() - start);
+    if (Field_History_push(&game->history, field) < 0)
+        err(1, "cannot remember the field");
+    Stats_bump(&metrics->started);
+}
+
+void Game_end(struct Game *game)
+{
+    Metrics_add(&Metrics_local()->freed, Game_bytes(game->field));
+    Field_History_free(&game->history);
+    free(game->field->field);
+    free(game->field->dirty);
+    game->field->field = NULL;
+    game->field->dirty = NULL;
+}
+
+/*
+ * Returns -1 if the move was refused. Clicks are turned into opening or
+ * flagging of the selected cell.
+ */
+int Game_apply(struct Game *game, struct Player_Move *move)
+{
+    struct Field *field = game->field;
+    int result = 0;
+
+    switch (move->action)
+    {
+    case Player_Move_Action_OPEN:
+    case Player_Move_Action_FLAG:
+    {
+        if (move->x < 0)
+        {
+            Game_warn(game, "%s is %s: %d", "x", "too small", move->x + 1);
+            return -1;
+        } else if (move->y < 0)
+        {
+            Game_warn(game, "%s is %s: %d", "y", "too small", move->y + 1);
+            return -1;
+        } else if (move->x >= field->width)
+        {
+            Game_warn(game, "%s is %s: %d", "x", "too large", move->x + 1);
+            return -1;
+        } else if (move->y >= field->height)
+        {
+            Game_warn(game, "%s is %s: %d", "y", "too large", move->y + 1);
+            return -1;
+        } else if (move->z < 0)
+        {
+            Game_warn(game, "%s is %s: %d", "z", "too small", move->z + 1);
+            return -1;
+        } else if (move->z >= field->depth)
+        {
+            Game_warn(game, "%s is %s: %d", "z", "too large", move->z + 1);
+            return -1;
+        }
+    } break;
+    case Player_Move_Action_UP:
+    case Player_Move_Action_DOWN:
+    case Player_Move_Action_LEFT:
+    case Player_Move_Action_RIGHT:
+    case Player_Move_Action_BACK:
+    case Player_Move_Action_FORTH:
+    {
+        field->field[game->selected_x + field->width * (game->selected_y + field->height * game->selected_z)].is_selected = 0;
+    } break;
+    case Player_Move_Action_CLICK_OPEN:
+    {
+        move->x = game->selected_x;
+        move->y = game->selected_y;
+        move->z = game->selected_z;
+        move->action = Player_Move_Action_OPEN;
+    } break;
+    case Player_Move_Action_CLICK_FLAG:
+    {
+        move->x = game->selected_x;
+        move->y = game->selected_y;
+        move->z = game->selected_z;
+        move->action = Player_Move_Action_FLAG;
+    } break;
+    default:
+        break;
+    }
+
+    switch (move->action)
+    {
+    case Player_Move_Action_OPEN:
+    {
+        uint64_t start = Stats_nanoseconds();
+
+        Field_open(field, move->x, move->y, move->z);
+        Metrics_time(&Metrics_local()->reveal, Stats_nanoseconds() - start);
+    } break;
+    case Player_Move_Action_FLAG:
+    {
+        unsigned i = move->x + field->width * (move->y + field->height * move->z);
+
+        switch (field->field[i].status)
+        {
+        break; case Field_Cell_Status_HIDDEN:
+            field->field[i].status = Field_Cell_Status_FLAGGED;
+            Field_touch(field, i);
+        break; case Field_Cell_Status_FLAGGED:
+            field->field[i].status = Field_Cell_Status_HIDDEN;
+            Field_touch(field, i);
+        }
+    } break;
+    case Player_Move_Action_UNDO:
+    {
+        if (Field_History_undo(&game->history, field) < 0)
+        {
+            Game_warn(game, "nothing to undo");
+            result = -1;
+        }
+        else
+            game->undone = 1;
+    } break;
+    case Player_Move_Action_REDO:
+    {
+        if (Field_History_redo(&game->history, field) < 0)
+        {
+            Game_warn(game, "nothing to redo");
+            result = -1;
+        }
+    } break;
+    case Player_Move_Action_UP:
+    {
+        if (field->wrap)
+            game->selected_y = (game->selected_y + field->height - move->y % field->height) % field->height;
+        else if (game->selected_y - move->y < 0)
+        {
+            Game_warn(game, "invalid location");
+            result = -1;
+        }
+        else
+            game->selected_y -= move->y;
+    } break;
+    case Player_Move_Action_DOWN:
+    {
+        if (field->wrap)
+            game->selected_y = (game->selected_y + move->y) % field->height;
+        else if (game->selected_y + move->y >= field->height)
+        {
+            Game_warn(game, "invalid location");
+            result = -1;
+        }
+        else
+            game->selected_y += move->y;
+    } break;
+    case Player_Move_Action_LEFT:
+    {
+        if (field->wrap)
+            game->selected_x = (game->selected_x + field->width - move->x % field->width) % field->width;
+        else if (game->selected_x - move->x < 0)
+        {
+            Game_warn(game, "invalid location");
+            result = -1;
+        }
+        else
+            game->selected_x -= move->x;
+    } break;
+    case Player_Move_Action_RIGHT:
+    {
+        if (field->wrap)
+            game->selected_x = (game->selected_x + move->x) % field->width;
+        else if (game->selected_x + move->x >= field->width)
+        {
+            Game_warn(game, "invalid location");
+            result = -1;
+        }
+        else
+            game->selected_x += move->x;
+    } break;
+    case Player_Move_Action_BACK:
+    {
+        if (field->wrap && field->depth > 1)
+            game->selected_z = (game->selected_z + field->depth - move->z % field->depth) % field->depth;
+        else if (game->selected_z - move->z < 0)
+        {
+            Game_warn(game, "invalid location");
+            result = -1;
+        }
+        else
+            game->selected_z -= move->z;
+    } break;
+    case Player_Move_Action_FORTH:
+    {
+        if (field->wrap && field->depth > 1)
+            game->selected_z = (game->selected_z + move->z) % field->depth;
+        else if (game->selected_z + move->z >= field->depth)
+        {
+            Game_warn(game, "invalid location");
+            result = -1;
+        }
+        else
+            game->selected_z += move->z;
+    } break;
+    default:
+        break;
+    }
+
+    switch (move->action)
+    {
+    case Player_Move_Action_OPEN:
+    case Player_Move_Action_FLAG:
+        if (Field_History_push(&game->history, field) < 0)
+            warn("cannot remember the move");
+        break;
+    case Player_Move_Action_UP:
+    case Player_Move_Action_DOWN:
+    case Player_Move_Action_LEFT:
+    case Player_Move_Action_RIGHT:
+    case Player_Move_Action_BACK:
+    case Player_Move_Action_FORTH:
+    case Player_Move_Action_UNDO:
+    case Player_Move_Action_REDO:
+        field->field[game->selected_x + field->width * (game->selected_y + field->height * game->selected_z)].is_selected = 1;
+        break;
+    default:
+        break;
+    }
+
+    return result;
+}
+
+/* A move is one write of the field, readers see it whole or not at all */
+int Game_move(struct Game *game, struct Player_Move *move)
+{
+    int result;
+
+    Field_writeBegin(game->field);
+    result = Game_apply(game, move);
+    Field_writeEnd(game->field);
+    return result;
+}
+
+/*
+ * The loop of a game turned inside out: Session_show prints the field and
+ * what became of the game, Session_move makes a move and shows it again.
+ * Between moves a session only waits, so it needs no thread or stack of
+ * its own and whoever reads the moves decides when it goes on.
+ */
+struct Session
+{
+    struct Game game;
+    struct Player_Parser parser;
+    /* of a timed game, or NULL */
+    struct Journal *journal;
+    /* where a won timed game is recorded under the name, or NULL */
+    const char *scores, *name;
+    struct Scores_Kind kind;
+    unsigned seed;
+    int ended;
+};
+
+void Session_show(struct Session *session, FILE *out)
+{
+    struct Game *game = &session->game;
+    struct Field *field = game->field;
+    int win;
+
+    Field_print(field, game->selected_z, out);
+    win = Field_isWin(field);
+    if (win > 0)
+        fprintf(out, "You won! UwU\n");
+    else if (win < 0)
+        fprintf(out, "You lost :<\n");
+    else if (field->depth > 1)
+        fprintf(out, "Your current location is (%d, %d, %d)\n", game->selected_x + 1, game->selected_y + 1, game->selected_z + 1);
+    else
+        fprintf(out, "Your current location is (%d, %d)\n", game->selected_x + 1, game->selected_y + 1);
+    if (win && !session->ended)
+        Stats_bump(win > 0 ? &Metrics_local()->won : &Metrics_local()->lost);
+    if (session->journal && win && !session->ended)
+        Journal_print(session->journal, field, out);
+    if (session->scores && session->journal && win > 0 && !session->ended && !game->undone)
+    {
+        struct Scores_Top top = {1, {{(session->journal->last - session->journal->start) / 1000, session->seed}}};
+
+        snprintf(top.entries[0].name, sizeof(top.entries[0].name), "%s", session->name);
+        if (Scores_record(session->scores, &session->kind, &top) < 0)
+            warn("cannot record the score in %s", session->scores);
+        else
+            Scores_print(&top, out);
+    }
+    session->ended = win != 0;
+}
+
+/* The move is timed from here, right after it was read */
+void Session_move(struct Session *session, struct Player_Move move, FILE *out)
+{
+    uint64_t now = session->journal ? Stats_nanoseconds() : 0;
+
+    Stats_bump(&Metrics_local()->moves[move.action]);
+    if (Game_move(&session->game, &move) >= 0 && session->journal && Journal_write(session->journal, move, now) < 0)
+        warn("cannot time the move");
+    Session_show(session, out);
+}
+
+/* A game left before its end still shows how long it took */
+void Session_close(struct Session *session, FILE *out)
+{
+    if (session->journal && !session->ended)
+        Journal_print(session->journal, session->game.field, out);
+}
+
+/*
+ * Serves games on a Unix socket, a session for every connection, all of
+ * them in one thread polling the sockets. Every field has the size, mines
+ * and topology given to the server, so the shape of a field with its
+ * offsets is shared and a session owns only its cells, dirty bytes,
+ * history and the move being read; sessions take turns in the shape.
+ *
+ * A session plays moves no faster than the rate of the server, what it
+ * reads meanwhile waits in a small queue and, once that is full, in the
+ * socket. What a move prints is a frame and is sent whole. A client
+ * taking them slower than they are made gets only the newest one, but
+ * never loses one that shows the end of its game, and is dropped if
+ * even those pile up.
+ */
+#define Server_INPUT 64
+/* fields a session remembers, the moves it can undo are one fewer */
+#define Server_HISTORY 64
+/* pending output allowed beyond two of the largest frames */
+#define Server_PENDING 65536
+
+struct Server_Client
+{
+    struct Session session;
+    struct Field_Cell *cells;
+    unsigned char *dirty;
+    /* output the socket did not take yet, the first kept bytes of it are never dropped */
+    char *pending;
+    size_t pending_size, kept;
+    /* when the bucket of moves is full again */
+    uint64_t full;
+    /* read, but not played yet */
+    unsigned char input[Server_INPUT];
+    unsigned input_size;
+    int fd, eof;
+};
+
+struct Server
+{
+    struct Field shape;
+    unsigned mines, seed;
+    int is_seed_set, timed;
+    enum Field_Generator generator;
+    /* moves a second, or 0 for any, and nanoseconds between them */
+    unsigned rate;
+    uint64_t interval, window;
+    /* the first one is the listening socket, it has no client */
+    struct pollfd *fds;
+    struct Server_Client **clients;
+    unsigned count, size;
+    /* sessions print here, then it is sent to their clients */
+    FILE *out;
+    char *output;
+    size_t length, frame;
+    uint64_t sessions;
+};
+
+volatile sig_atomic_t Server_stop;
+
+void Server_signal(int signal)
+{
+    (void)signal;
+    Server_stop = 1;
+}
+
+void Server_enter(struct Server *server, struct Server_Client *client)
+{
+    server->shape.field = client->cells;
+    server->shape.dirty = client->dirty;
+}
+
+int Server_keep(struct Server_Client *client, const char *data, size_t size)
+{
+    char *pending;
+
+    if (!(pending = realloc(client->pending, client->pending_size + size)))
+        return -1;
+    memcpy(pending + client->pending_size, data, size);
+    client->pending = pending;
+    client->pending_size += size;
+    return 0;
+}
+
+/*
+ * Sends the frame the session printed, or leaves it pending in place of
+ * the one before it unless that is kept. Returns -1 when the client is
+ * too slow or gone.
+ */
+int Server_flush(struct Server *server, struct Server_Client *client, int keep)
+{
+    ssize_t sent = 0;
+    int ret = 0;
+
+    if (fflush(server->out))
+        return -1;
+    if (server->length > server->frame)
+        server->frame = server->length;
+    if (client->fd >= 0 && !client->pending_size && (sent = write(client->fd, server->output, server->length)) < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            ret = -1;
+        sent = 0;
+    }
+    if (client->fd >= 0 && !ret && (size_t)sent < server->length)
+    {
+        /* a frame begun is sent to its end */
+        keep = keep || sent;
+        client->pending_size = client->kept;
+        ret = Server_keep(client, server->output + sent, server->length - sent);
+        if (keep)
+            client->kept = client->pending_size;
+        /* a frame begun and one kept fit however large the field is */
+        if (client->pending_size > Server_PENDING + 2 * server->frame)
+            ret = -1;
+    }
+    fseeko(server->out, 0, SEEK_SET);
+    return ret;
+}
+
+int Server_send(struct Server_Client *client)
+{
+    ssize_t sent = write(client->fd, client->pending, client->pending_size);
+
+    if (sent < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    if ((size_t)sent < client->kept)
+        client->kept -= sent;
+    else
+        client->kept = (size_t)sent > client->kept ? client->pending_size - sent : 0;
+    memmove(client->pending, client->pending + sent, client->pending_size - sent);
+    client->pending_size -= sent;
+    return 0;
+}
+
+int Server_grow(struct Server *server)
+{
+    unsigned size = server->size ? 2 * server->size : 64;
+    struct pollfd *fds;
+    struct Server_Client **clients;
+
+    if (server->count < server->size)
+        return 0;
+    if (!(fds = realloc(server->fds, size * sizeof(*fds))))
+        return -1;
+    server->fds = fds;
+    if (!(clients = realloc(server->clients, size * sizeof(*clients))))
+        return -1;
+    server->clients = clients;
+    server->size = size;
+    return 0;
+}
+
+/* A client with no socket only takes memory, as an idle one does */
+int Server_add(struct Server *server, int fd)
+{
+    struct Server_Client *client;
+    unsigned seed = server->seed + server->sessions;
+
+    if (Server_grow(server) < 0)
+        return -1;
+    if (!server->is_seed_set && getentropy(&seed, sizeof(seed)) < 0)
+        return -1;
+    if (!(client = calloc(1, sizeof(*client))))
+        return -1;
+    if (server->timed && !(client->session.journal = calloc(1, sizeof(*client->session.journal))))
+    {
+        free(client);
+        return -1;
+    }
+
+    client->fd = fd;
+    client->session.seed = seed;
+    Game_start(&client->session.game, &server->shape, server->mines, seed, server->generator);
+    client->session.game.errors = server->out;
+    client->session.game.history.limit = Server_HISTORY;
+    client->cells = server->shape.field;
+    client->dirty = server->shape.dirty;
+    server->fds[server->count] = (struct pollfd){.fd = fd, .events = POLLIN};
+    server->clients[server->count++] = client;
+    ++server->sessions;
+
+    /* a client gone already is removed when its socket is polled */
+    Session_show(&client->session, server->out);
+    Server_flush(server, client, 0);
+    return 0;
+}
+
+void Server_remove(struct Server *server, unsigned i)
+{
+    struct Server_Client *client = server->clients[i];
+
+    Server_enter(server, client);
+    Session_close(&client->session, server->out);
+    Server_flush(server, client, 1);
+    Game_end(&client->session.game);
+    if (client->session.journal)
+        Journal_free(client->session.journal);
+    free(client->session.journal);
+    free(client->pending);
+    if (client->fd >= 0)
+        close(client->fd);
+    free(client);
+
+    server->fds[i] = server->fds[--server->count];
+    server->clients[i] = server->clients[server->count];
+}
+
+/* Returns -1 when the client is gone, a hang up with a full queue is too */
+int Server_receive(struct Server_Client *client)
+{
+    ssize_t got;
+
+    if (client->eof || client->input_size == Server_INPUT)
+        return -1;
+    got = read(client->fd, client->input + client->input_size, Server_INPUT - client->input_size);
+    if (got < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    client->eof = !got;
+    client->input_size += got;
+    return 0;
+}
+
+/* Plays the moves the rate allows now, returns -1 when the client is done */
+int Server_play(struct Server *server, struct Server_Client *client, uint64_t now)
+{
+    struct Player_Move move;
+    unsigned i;
+
+    Server_enter(server, client);
+    for (i = 0; i < client->input_size && client->full <= now + server->window; ++i)
+    {
+        int ended = client->session.ended;
+
+        if (!Player_parse(&client->session.parser, client->input[i], &move))
+            continue;
+        client->full = (client->full > now ? client->full : now) + server->interval;
+        Session_move(&client->session, move, server->out);
+        if (Server_flush(server, client, client->session.ended && !ended) < 0)
+            return -1;
+    }
+    memmove(client->input, client->input + i, client->input_size - i);
+    client->input_size -= i;
+    return client->eof && !client->input_size ? -1 : 0;
+}
+
+int Server_open(struct Server *server, int listener)
+{
+    if (!(server->out = open_memstream(&server->output, &server->length)) || Server_grow(server) < 0)
+        return -1;
+    if (server->rate)
+    {
+        /* a bucket holds the moves of one second */
+        server->interval = 1000000000 / server->rate;
+        server->window = (server->rate - 1) * server->interval;
+    }
+    server->fds[0] = (struct pollfd){.fd = listener, .events = POLLIN};
+    server->clients[0] = NULL;
+    server->count = 1;
+    return 0;
+}
+
+void Server_close(struct Server *server)
+{
+    while (server->count > 1)
+        Server_remove(server, server->count - 1);
+    fclose(server->out);
+    free(server->output);
+    free(server->fds);
+    free(server->clients);
+}
+
+int Server_run(struct Server *server, const char *path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    struct sigaction action = {.sa_handler = Server_signal};
+    int listener, fd;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+        errx(1, "%s is %s", path, "too long for a socket");
+    memcpy(address.sun_path, path, strlen(path) + 1);
+    if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        err(1, "socket()");
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0)
+        err(1, "cannot bind %s", path);
+    if (listen(listener, SOMAXCONN) < 0 || fcntl(listener, F_SETFL, O_NONBLOCK) < 0)
+        err(1, "cannot listen on %s", path);
+
+    /* poll is woken by the signals, so the sessions end as with end of input */
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (Server_open(server, listener) < 0)
+        err(1, "cannot start the server");
+
+    while (!Server_stop)
+    {
+        uint64_t now = Stats_nanoseconds();
+        int timeout = -1;
+
+        for (unsigned i = 1; i < server->count; ++i)
+        {
+            struct Server_Client *client = server->clients[i];
+
+            server->fds[i].events = client->pending_size ? POLLOUT : 0;
+            if (!client->eof && client->input_size < Server_INPUT)
+                server->fds[i].events |= POLLIN;
+            /* what is left in the queue waits for the bucket */
+            if (client->input_size)
+            {
+                int wait = client->full > now + server->window ? (client->full - server->window - now + 999999) / 1000000 : 0;
+
+                if (timeout < 0 || wait < timeout)
+                    timeout = wait;
+            }
+        }
+        if (poll(server->fds, server->count, timeout) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            err(1, "poll()");
+        }
+
+        /* backwards, so the last client moved over a removed one was seen */
+        now = Stats_nanoseconds();
+        for (unsigned i = server->count; i-- > 1;)
+        {
+            struct Server_Client *client = server->clients[i];
+            short revents = server->fds[i].revents;
+
+            if ((revents & POLLOUT && Server_send(client) < 0)
+                || (revents & (POLLIN | POLLHUP | POLLERR) && Server_receive(client) < 0)
+                || ((client->input_size || client->eof) && Server_play(server, client, now) < 0))
+                Server_remove(server, i);
+        }
+
+        if (server->fds[0].revents & POLLIN)
+        {
+            while ((fd = accept(listener, NULL, NULL)) >= 0)
+            {
+                if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || Server_add(server, fd) < 0)
+                {
+                    warn("cannot start a session");
+                    close(fd);
+                }
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                warn("accept()");
+        }
+    }
+
+    Server_close(server);
+    close(listener);
+    unlink(path);
+    return 0;
+}
+
+/* Starts sessions nobody plays and shows how much memory they hold */
+int Server_idle(struct Server *server, uint64_t count)
+{
+    struct rusage before, after;
+    uint64_t start, took;
+
+    getrusage(RUSAGE_SELF, &before);
+    start = Stats_nanoseconds();
+    if (Server_open(server, -1) < 0)
+        err(1, "cannot start the server");
+    for (uint64_t i = 0; i < count; ++i)
+        if (Server_add(server, -1) < 0)
+            err(1, "cannot start session %" PRIu64, i);
+    took = Stats_nanoseconds() - start;
+    getrusage(RUSAGE_SELF, &after);
+
+    /* the resident size is in kilobytes */
+    printf("sessions %" PRIu64 "\n", count);
+    printf("time per session %.3f us\n", count ? took / 1000. / count : 0.);
+    printf("memory per session %.0f bytes\n", count ? (after.ru_maxrss - before.ru_maxrss) * 1024. / count : 0.);
+    printf("session %zu bytes, cells %zu bytes\n", sizeof(struct Server_Client), (size_t)Field_cells(&server->shape) * sizeof(struct Field_Cell));
+
+    Server_close(server);
+    return 0;
+}
+
+/*
+ * Load for the server of -l. Sessions connect to its socket, send a move,
+ * wait for the field it shows back and send the next one no sooner than
+ * the rate allows, and connect again once the game ends. A move opens a
+ * random hidden cell or, for the solver, does what a single number
+ * proves. Every thread polls its share of the sessions and counts in its
+ * own histogram, which is read relaxed every second.
+ */
+#define Load_STEPS 8
+#define Load_BUCKETS (64 * Load_STEPS)
+#define Load_READ 4096
+/* longest a thread sleeps before it sees it was stopped, in ms */
+#define Load_TICK 100
+
+struct Load_Counters
+{
+    _Atomic uint64_t won, lost, failed;
+    /* moves by the time their field took to come */
+    _Atomic uint64_t latency[Load_BUCKETS];
+};
+
+struct Load_Worker
+{
+    _Alignas(64) struct Load_Counters counters;
+    struct Field shape;
+    struct Random random;
+};
+
+struct Load_Session
+{
+    /* as shown by the last frame, flat fields only */
+    struct Field_Cell *cells;
+    /* what was read of the next frame */
+    char *frame;
+    size_t frame_size;
+    /* when the move was sent and when the next one may be */
+    uint64_t sent, due;
+    int fd, ready;
+};
+
+struct Load
+{
+    const char *path;
+    struct Field shape;
+    int solver;
+    unsigned rate;
+    /* of the latency, in ns */
+    uint64_t deadline;
+    struct Load_Worker *workers;
+    unsigned threads;
+    /* counters as of the last report */
+    struct Load_Counters seen;
+    uint64_t start, last;
+};
+
+/* threads poll it, so it is atomic, which is lock-free for a signal too */
+_Atomic int Load_stop;
+
+void Load_signal(int signal)
+{
+    (void)signal;
+    atomic_store_explicit(&Load_stop, 1, memory_order_relaxed);
+}
+
+/* Buckets of every power of 2 are cut in Load_STEPS */
+unsigned Load_bucket(uint64_t nanoseconds)
+{
+    unsigned bit;
+
+    if (nanoseconds < Load_STEPS)
+        return nanoseconds;
+    bit = 63 - __builtin_clzll(nanoseconds);
+    return (bit - 2) * Load_STEPS + (nanoseconds >> (bit - 3) & (Load_STEPS - 1));
+}
+
+/* Highest latency the bucket holds */
+uint64_t Load_bound(unsigned bucket)
+{
+    unsigned bit = bucket / Load_STEPS + 2;
+
+    if (bucket < Load_STEPS)
+        return bucket;
+    return ((uint64_t)(Load_STEPS + bucket % Load_STEPS + 1) << (bit - 3)) - 1;
+}
+
+double Load_percentile(const struct Load_Counters *counters, uint64_t moves, double share)
+{
+    uint64_t rank = share * moves, below = 0;
+
+    for (unsigned i = 0; i < Load_BUCKETS; ++i)
+        if ((below += counters->latency[i]) > rank)
+            return Load_bound(i) / 1000.;
+    return 0.;
+}
+
+/* Sums counters of all threads into sum, and takes the last sum off them if seen is set */
+uint64_t Load_sum(struct Load *load, struct Load_Counters *sum, struct Load_Counters *seen)
+{
+    uint64_t moves = 0;
+
+    memset(sum, 0, sizeof(*sum));
+    for (unsigned i = 0; i < load->threads; ++i)
+    {
+        struct Load_Counters *counters = &load->workers[i].counters;
+
+        sum->won += atomic_load_explicit(&counters->won, memory_order_relaxed);
+        sum->lost += atomic_load_explicit(&counters->lost, memory_order_relaxed);
+        sum->failed += atomic_load_explicit(&counters->failed, memory_order_relaxed);
+        for (unsigned k = 0; k < Load_BUCKETS; ++k)
+            sum->latency[k] += atomic_load_explicit(&counters->latency[k], memory_order_relaxed);
+    }
+    for (unsigned k = 0; k < Load_BUCKETS; ++k)
+    {
+        if (seen)
+        {
+            uint64_t all = sum->latency[k];
+
+            sum->latency[k] -= seen->latency[k];
+            seen->latency[k] = all;
+        }
+        moves += sum->latency[k];
+    }
+    if (seen)
+    {
+        struct Load_Counters all = {sum->won, sum->lost, sum->failed, {0}};
+
+        sum->won -= seen->won;
+        sum->lost -= seen->lost;
+        sum->failed -= seen->failed;
+        seen->won = all.won;
+        seen->lost = all.lost;
+        seen->failed = all.failed;
+    }
+    return moves;
+}
+
+void Load_print(struct Load *load, const struct Load_Counters *counters, uint64_t moves, double seconds)
+{
+    uint64_t within = 0;
+
+    for (unsigned i = 0; i < Load_BUCKETS && Load_bound(i) <= load->deadline; ++i)
+        within += counters->latency[i];
+    printf(
+        "%.0f s: %.0f moves/s, %.1f games/s, %" PRIu64 " won, %" PRIu64 " lost, %" PRIu64 " failed,"
+        " p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, %.3f%% within %.0f us\n",
+        (Stats_nanoseconds() - load->start) / 1e9,
+        seconds > 0 ? moves / seconds : 0., seconds > 0 ? (counters->won + counters->lost) / seconds : 0.,
+        (uint64_t)counters->won, (uint64_t)counters->lost, (uint64_t)counters->failed,
+        Load_percentile(counters, moves, .5), Load_percentile(counters, moves, .9),
+        Load_percentile(counters, moves, .99), Load_percentile(counters, moves, .999),
+        moves ? 100. * within / moves : 100., load->deadline / 1000.
+    );
+    fflush(stdout);
+}
+
+void Load_progress(void *context)
+{
+    struct Load *load = context;
+    struct Load_Counters sum;
+    uint64_t now = Stats_nanoseconds(), moves = Load_sum(load, &sum, &load->seen);
+
+    Load_print(load, &sum, moves, (now - load->last) / 1e9);
+    load->last = now;
+}
+
+void Load_connect(struct Load *load, struct Load_Worker *worker, struct Load_Session *session, uint64_t now)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+    memcpy(address.sun_path, load->path, strlen(load->path) + 1);
+    session->frame_size = 0;
+    session->ready = 0;
+    /* a full backlog refuses at once instead of blocking other sessions */
+    if ((session->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+        || fcntl(session->fd, F_SETFL, O_NONBLOCK) < 0
+        || connect(session->fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        if (session->fd >= 0)
+            close(session->fd);
+        session->fd = -1;
+        session->due = now + Load_TICK * 1000000;
+        Stats_bump(&worker->counters.failed);
+    }
+}
+
+/* Takes the rows of the field that end at end of the frame */
+int Load_parse(struct Load_Worker *worker, struct Load_Session *session, size_t end)
+{
+    struct Field *shape = &worker->shape;
+    size_t row = end;
+
+    for (unsigned y = shape->height; y-- > 0;)
+    {
+        size_t last, shift = y & shape->topology->parity;
+
+        if (!row)
+            return -1;
+        for (last = row - 1, row = last; row > 0 && session->frame[row - 1] != '\n'; --row);
+        if (last - row != 2 * shape->width + shift)
+            return -1;
+        for (unsigned x = 0; x < shape->width; ++x)
+        {
+            struct Field_Cell *c = session->cells + x + y * shape->width;
+            char shown = session->frame[row + 2 * x + 1 + shift];
+            const char *number = shown ? strchr(Field_NUMBERS, shown) : NULL;
+
+            c->status = shown == ']'
+                ? Field_Cell_Status_HIDDEN
+                : shown == '?'
+                    ? Field_Cell_Status_FLAGGED
+                    : Field_Cell_Status_OPENED;
+            c->is_mine = shown == '#';
+            c->mines_near = number ? number - Field_NUMBERS : 0;
+        }
+    }
+    return 0;
+}
+
+int Load_choose(struct Load *load, struct Load_Worker *worker, struct Load_Session *session, char *move, size_t size)
+{
+    struct Field *shape = &worker->shape;
+    unsigned cells = Field_cells(shape), hidden = 0, i;
+
+    if (!session->cells)
+    {
+        unsigned x = Random_next(&worker->random) % shape->width;
+        unsigned y = Random_next(&worker->random) % shape->height;
+        unsigned z = Random_next(&worker->random) % shape->depth;
+
+        return snprintf(move, size, "#%ux%ux%u;", x + 1, y + 1, z + 1);
+    }
+
+    shape->field = session->cells;
+    for (i = 0; load->solver && i < cells; ++i)
+    {
+        struct Field_Cell c = session->cells[i];
+        unsigned x = i % shape->width, y = i / shape->width, unknown = 0, flagged = 0;
+        const struct Field_Near *near;
+
+        if (c.status != Field_Cell_Status_OPENED || c.is_mine || !c.mines_near)
+            continue;
+        near = Field_near(shape, x, y, 0);
+        for (unsigned k = 0; k < near->count; ++k)
+        {
+            unknown += session->cells[i + near->offset[k]].status == Field_Cell_Status_HIDDEN;
+            flagged += session->cells[i + near->offset[k]].status == Field_Cell_Status_FLAGGED;
+        }
+        if (!unknown || (flagged != c.mines_near && (flagged + unknown - 1) * shape->most >= c.mines_near))
+            continue;
+        for (unsigned k = 0; k < near->count; ++k)
+            if (session->cells[i + near->offset[k]].status == Field_Cell_Status_HIDDEN)
+                return snprintf(move, size, "%c%ux%u;", flagged == c.mines_near ? '#' : '?', x + near->x[k] + 1, y + near->y[k] + 1);
+    }
+
+    for (i = 0; i < cells; ++i)
+        hidden += session->cells[i].status == Field_Cell_Status_HIDDEN;
+    if (!hidden)
+        return -1;
+    hidden = Random_next(&worker->random) % hidden;
+    for (i = 0; session->cells[i].status != Field_Cell_Status_HIDDEN || hidden--; ++i);
+    return snprintf(move, size, "#%ux%u;", i % shape->width + 1, i / shape->width + 1);
+}
+
+/* Returns 1 when the game ended, -1 when the session failed */
+int Load_read(struct Load_Worker *worker, struct Load_Session *session, uint64_t now)
+{
+    size_t line = session->frame_size;
+    char *frame, *end;
+    ssize_t got;
+
+    if (!(frame = realloc(session->frame, session->frame_size + Load_READ)))
+        return -1;
+    session->frame = frame;
+    if ((got = read(session->fd, frame + session->frame_size, Load_READ)) <= 0)
+        return got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    session->frame_size += got;
+
+    /* a frame ends with the line after the field */
+    for (; line > 0 && frame[line - 1] != '\n'; --line);
+    while ((end = memchr(frame + line, '\n', session->frame_size - line)))
+    {
+        int won = !strncmp(frame + line, "You won", 7), lost = !strncmp(frame + line, "You lost", 8);
+
+        if (!won && !lost && strncmp(frame + line, "Your current location", 21))
+        {
+            line = end + 1 - frame;
+            continue;
+        }
+        if (session->sent)
+            Stats_bump(&worker->counters.latency[Load_bucket(now - session->sent)]);
+        session->sent = 0;
+        if (won || lost)
+        {
+            Stats_bump(won ? &worker->counters.won : &worker->counters.lost);
+            return 1;
+        }
+        if (session->cells && Load_parse(worker, session, line) < 0)
+            return -1;
+        session->ready = 1;
+
+        session->frame_size -= end + 1 - frame;
+        memmove(frame, end + 1, session->frame_size);
+        line = 0;
+    }
+    return 0;
+}
+
+int Load_work(void *context, unsigned worker_index, uint64_t first, uint64_t last)
+{
+    struct Load *load = context;
+    struct Load_Worker *worker = &load->workers[worker_index];
+    unsigned count = last - first, cells = Field_cells(&load->shape);
+    uint64_t interval = load->rate ? 1000000000 / load->rate : 0;
+    struct Load_Session *sessions;
+    struct pollfd *fds;
+
+    if (!(sessions = calloc(count, sizeof(*sessions))) || !(fds = calloc(count, sizeof(*fds))))
+        err(1, "calloc()");
+    worker->shape = load->shape;
+    Random_seed(&worker->random, first);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        sessions[i].fd = -1;
+        if (load->shape.depth == 1 && !(sessions[i].cells = calloc(cells, sizeof(*sessions[i].cells))))
+            err(1, "calloc()");
+    }
+
+    while (!atomic_load_explicit(&Load_stop, memory_order_relaxed))
+    {
+        uint64_t now = Stats_nanoseconds();
+        int timeout = Load_TICK;
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            struct Load_Session *session = sessions + i;
+            char move[64];
+            int length;
+
+            if (session->fd < 0 && session->due <= now)
+                Load_connect(load, worker, session, now);
+            if (session->fd >= 0 && session->ready && session->due <= now)
+            {
+                if ((length = Load_choose(load, worker, session, move, sizeof(move))) < 0 || write(session->fd, move, length) != length)
+                {
+                    Stats_bump(&worker->counters.failed);
+                    close(session->fd);
+                    session->fd = -1;
+                }
+                session->ready = 0;
+                session->sent = now;
+                session->due = now + interval;
+            }
+            else if (session->fd < 0 || session->ready)
+            {
+                int wait = session->due > now ? (session->due - now + 999999) / 1000000 : 0;
+
+                timeout = wait < timeout ? wait : timeout;
+            }
+            fds[i] = (struct pollfd){.fd = session->fd, .events = POLLIN};
+        }
+
+        if (poll(fds, count, timeout) < 0 && errno != EINTR)
+            err(1, "poll()");
+
+        now = Stats_nanoseconds();
+        for (unsigned i = 0; i < count; ++i)
+        {
+            struct Load_Session *session = sessions + i;
+            int ret;
+
+            if (session->fd < 0 || !fds[i].revents || !(ret = Load_read(worker, session, now)))
+                continue;
+            if (ret < 0)
+                Stats_bump(&worker->counters.failed);
+            close(session->fd);
+            session->fd = -1;
+        }
+    }
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (sessions[i].fd >= 0)
+            close(sessions[i].fd);
+        free(sessions[i].cells);
+        free(sessions[i].frame);
+    }
+    free(fds);
+    free(sessions);
+    return 1;
+}
+
+int Load_run(struct Load *load, uint64_t sessions, struct Pool *pool)
+{
+    struct Pool_Job job = {Load_work, Load_progress, load, sessions, (sessions + pool->threads - 1) / pool->threads};
+    struct sigaction action = {.sa_handler = Load_signal};
+    struct Load_Counters sum;
+    uint64_t moves;
+
+    if (strlen(load->path) >= sizeof(((struct sockaddr_un *)NULL)->sun_path))
+        errx(1, "%s is %s", load->path, "too long for a socket");
+    if (!(load->workers = aligned_alloc(_Alignof(struct Load_Worker), pool->threads * sizeof(*load->workers))))
+        err(1, "aligned_alloc()");
+    memset(load->workers, 0, pool->threads * sizeof(*load->workers));
+    load->threads = pool->threads;
+
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* a thread has a block of sessions, which is never split */
+    load->start = load->last = Stats_nanoseconds();
+    Pool_run(pool, &job);
+
+    moves = Load_sum(load, &sum, NULL);
+    printf("total ");
+    Load_print(load, &sum, moves, (Stats_nanoseconds() - load->start) / 1e9);
+    free(load->workers);
+    return 0;
+}
+
+#ifndef FUZZ
+int main(int argc, char **argv)
+{
+    struct Field field = {10, 10, 1};
+    struct Session session = {0};
+    struct Journal journal = {0};
+    /* the thread of spectators outlives main, so they are not on its stack */
+    static struct Watch spectators;
+    struct Player_Move move;
+    int timed = 0;
+    unsigned seed, mines = 0;
+    int is_mines_set = 0, is_seed_set = 0, ch;
+    int show_seed = 0, batch = 0, reveal = 0, is_count_set = 0, wrap = 0;
+    const char *corpus_create = NULL, *corpus_query = NULL;
+    enum Field_Metric corpus_metric = Field_Metric_3BV;
+    uint32_t corpus_ranges[Field_Metric_COUNT][2];
+    uint64_t corpus_count = 1000000;
+    struct Search search = {.all = 0};
+    int find = 0;
+    const char *recover = NULL, *scores = NULL;
+    enum Field_Generator generator = Field_Generator_RANDOM;
+    enum Field_Topology topology = Field_Topology_SQUARE;
+    unsigned most = 1;
+    enum Kernel_Level level = Kernel_Level_COUNT;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    struct Pool pool;
+    int pin = 0;
+    const char *serve = NULL;
+    int idle = 0;
+    unsigned rate = 100;
+    struct Load load = {.deadline = 1000000};
+    const char *metrics = NULL, *watch = NULL;
+
+#ifdef __OpenBSD__
+    pledge("stdio rpath wpath cpath flock unix", NULL);
+#endif
+
+    for (int m = 0; m < Field_Metric_COUNT; ++m)
+    {
+        corpus_ranges[m][0] = 0;
+        corpus_ranges[m][1] = UINT32_MAX;
+    }
+
+    while ((ch = getopt(argc, argv, "haiABDFNOPSTWC:G:L:M:Q:R:V:d:j:k:l:m:n:p:q:r:s:t:")) > 0)
+    {
+        switch (ch)
+        {
+        case 'A':
+        {
+            search.all = 1;
+        } break;
+        case 'B':
+        {
+            batch = 1;
+        } break;
+        case 'a':
+        {
+            pin = 1;
+        } break;
+        case 'i':
+        {
+            idle = 1;
+        } break;
+        case 'O':
+        {
+            reveal = 1;
+        } break;
+        case 'D':
+        {
+            load.solver = 1;
+        } break;
+        case 'F':
+        {
+            find = 1;
+        } break;
+        case 'N':
+        {
+            search.no_guess = 1;
+        } break;
+        case 'P':
+        {
+            generator = Field_Generator_SHUFFLE;
+        } break;
+        case 'C':
+        {
+            corpus_create = optarg;
+        } break;
+        case 'Q':
+        {
+            corpus_query = optarg;
+        } break;
+        case 'G':
+        {
+            load.path = optarg;
+        } break;
+        case 'L':
+        {
+            timed = 1;
+            scores = optarg;
+        } break;
+        case 'M':
+        {
+            const char *e;
+
+            most = strtonum(optarg, 1, Field_MINE_MAX, &e);
+            if (e)
+            {
+                warnx("%s is %s: %s", "most", e, optarg);
+                usage(0);
+            }
+        } break;
+        case 'R':
+        {
+            find = 1;
+            recover = optarg;
+        } break;
+        case 'd':
+        {
+            const char *e;
+
+            load.deadline = strtonum(optarg, 1, 1000000000, &e) * 1000;
+            if (e)
+            {
+                warnx("%s is %s: %s", "latency", e, optarg);
+                usage(0);
+            }
+        } break;
+        case 'j':
+        {
+            const char *e;
+
+            jobs = strtonum(optarg, 1, 1024, &e);
+            if (e)
+            {
+                warnx("%s is %s: %s", "jobs", e, optarg);
+                usage(0);
+            }
+        } break;
+        case 'k':
+        {
+            for (level = 0; level < Kernel_Level_COUNT; ++level)
+                if (!strcmp(optarg, Kernel_Level_NAMES[level]))
+                    break;
+            if (level == Kernel_Level_COUNT)
+            {
+                warnx("%s is %s: %s", "level", "unknown", optarg);
+                usage(0);
+            }
+        } break;
+        case 'l':
+        {
+            serve = optarg;
+        } break;
+        case 'p':
+        {
+            metrics = optarg;
+        } break;
+        case 'V':
+        {
+            watch = optarg;
+        } break;
+        case 'n':
+        {
+            const char *e;
+
+            is_count_set = 1;
+            corpus_count = strtonum(optarg, 1, (long long)UINT32_MAX + 1, &e);
+            if (e)
+            {
+                warnx("%s is %s: %s", "count", e, optarg);
+                usage(0);
+            }
+        } break;
+        case 'q':
+        {
+            const char *e;
+
+            rate = strtonum(optarg, 0, 1000000, &e);
+            if (e)
+            {
+                warnx("%s is %s: %s", "rate", e, optarg);
+                usage(0);
+            }
+        } break;
+        case 'r':
+        {
+            char *min = strchr(optarg, '='), *max;
+            const char *e;
+
+            if (!min || !(max = strchr(min, '-')))
+            {
+                warnx("%s is %s: %s", "range", "invalid", optarg);
+                usage(0);
+            }
+            *min++ = '\0';
+            *max++ = '\0';
+
+            for (corpus_metric = 0; corpus_metric < Field_Metric_COUNT; ++corpus_metric)
+                if (!strcmp(optarg, Field_Metric_NAMES[corpus_metric]))
+                    break;
+            if (corpus_metric == Field_Metric_COUNT)
+            {
+                warnx("%s is %s: %s", "metric", "unknown", optarg);
+                usage(0);
+            }
+
+            corpus_ranges[corpus_metric][0] = strtonum(min, 0, UINT32_MAX, &e);
+            if (e)
+            {
+                warnx("%s is %s: %s", "min", e, min);
+                usage(0);
+            }
+            corpus_ranges[corpus_metric][1] = strtonum(max, 0, UINT32_MAX, &e);
+            if (e)
+            {
+                warnx("%s is %s: %s", "max", e, max);
+                usage(0);
+            }
+        } break;
+        case 't':
+        {
+            for (topology = 0; topology < Field_Topology_COUNT; ++topology)
+                if (!strcmp(optarg, Field_Topology_OFFSETS[topology].name))
+                    break;
+            if (topology == Field_Topology_COUNT)
+            {
+                warnx("%s is %s: %s", "topology", "unknown", optarg);
+                usage(0);
+            }
+        } break;
+        case 's':
+        {
+            const char *e;
+
+            is_seed_set = 1;
+            seed = strtonum(optarg, 0, UINT_MAX, &e);
+            if (e)
+            {
+                warnx("%s is %s: %s", "seed", e, optarg);
+                usage(0);
+            }
+        } break;
+        case 'm':
+        {
+            const char *e;
+
+            is_mines_set = 1;
+            mines = strtonum(optarg, 0, UINT_MAX, &e);
+            if (e)
+            {
+                warnx("%s is %s: %s", "mines", e, optarg);
+                usage(0);
+            }
+        } break;
+        case 'S':
+        {
+            show_seed = 1;
+        } break;
+        case 'T':
+        {
+            wrap = 1;
+        } break;
+        case 'W':
+        {
+            timed = 1;
+        } break;
+        case 'h':
+        {
+            usage(1);
+        } break;
+        default:
+        {
+            usage(0);
+        } break;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    switch (argc)
+    {
+    case 0:
+        break;
+    case 2:
+    case 3:
+    {
+        char *names[] = {"width", "height", "depth"};
+
+        for (int i = 0; i < argc; ++i)
+        {
+            const char *e;
+
+            ((unsigned *)&field)[i] = strtonum(argv[i], 1, UINT_MAX, &e);
+            if (e)
+            {
+                warnx("%s is %s: %s", names[i], e, argv[i]);
+                usage(0);
+            }
+        }
+    } break;
     default:
     {
-        warnx("you should pass exactly 2 positional arguments");
+        warnx("you should pass exactly 2 or 3 positional arguments");
         usage(0);
     } break;
     }
+    /* cells are counted, allocated and shuffled with their mines in unsigned */
+    if (field.width > UINT_MAX / (most > sizeof(struct Field_Cell) ? most : sizeof(struct Field_Cell)) / field.height / field.depth)
+    {
+        warnx("%s is %s: %ux%ux%u", "field", "too large", field.width, field.height, field.depth);
+        usage(0);
+    }
+
+    if (field.depth > 1 && topology == Field_Topology_KNIGHT)
+    {
+        warnx("%s is %s: %s", "topology", "flat only", Field_Topology_OFFSETS[topology].name);
+        usage(0);
+    }
+    if (field.depth > 1 && recover)
+    {
+        warnx("%s is %s: %u", "depth", "not 1 for -R", field.depth);
+        usage(0);
+    }
+    if (field.depth > 1 && load.solver)
+    {
+        warnx("%s is %s: %u", "depth", "not 1 for -D", field.depth);
+        usage(0);
+    }
+    if (most > 1 && recover)
+    {
+        warnx("%s is %s: %u", "most", "not 1 for -R", most);
+        usage(0);
+    }
+    if (wrap)
+    {
+        unsigned least = 2 * Field_Topology_OFFSETS[topology].reach + 1;
+
+        if (field.width < least || field.height < least || (field.depth > 1 && field.depth < least))
+        {
+            warnx("%s is %s: %ux%ux%u", "torus", "too small", field.width, field.height, field.depth);
+            usage(0);
+        }
+        if (field.height % 2 && Field_Topology_OFFSETS[topology].parity)
+        {
+            warnx("%s is %s: %u", "height", "odd for a hex torus", field.height);
+            usage(0);
+        }
+    }
+    if (Kernel_select(level) < 0)
+    {
+        warnx("%s is %s: %s", "level", "not supported", Kernel_Level_NAMES[level]);
+        usage(0);
+    }
+    Field_init(&field, wrap, topology, most);
+    if (Field_around(&field) * most > Field_COUNT_MAX)
+    {
+        warnx("%s is %s: %u", "count", "too large for this build", Field_around(&field) * most);
+        usage(0);
+    }
 
     if (!is_seed_set)
-        if (getentropy(&seed, sizeof(seed)) < 0)
+    {
+        if (corpus_create || batch || reveal || find)
+            seed = 0;
+        else if (getentropy(&seed, sizeof(seed)) < 0)
             err(1, "getentropy()");
+    }
 
     if (!is_mines_set)
     {
-        mines = field.width * field.height / 10;
+        mines = Field_cells(&field) / 10;
     }
-    else if (mines > field.width * field.height)
+    else if (mines > Field_cells(&field) * most)
     {
         warnx("%s is %s: %u", "mines", "too large", mines);
         usage(0);
     }
 
+    if (load.path)
+    {
+        if (!is_count_set)
+            corpus_count = 1000;
+        /* a block of the load is whole sessions, threads past them would only wait */
+        if (jobs > 0 && (uint64_t)jobs > corpus_count)
+            jobs = corpus_count;
+    }
+
+    /* threads are shared by whatever runs in parallel */
+    if (corpus_create || batch || reveal || find || load.path)
+        Pool_init(&pool, jobs > 0 ? jobs : 1, pin);
+
+    if (corpus_create)
+        return Corpus_create(corpus_create, field.width, field.height, field.depth, wrap, topology, most, mines, generator, seed, corpus_count, &pool);
+    if (batch)
+        return Batch_run(field.width, field.height, field.depth, wrap, topology, most, mines, generator, seed, corpus_count, &pool, scores);
+    if (reveal)
+        return Reveal_run(field.width, field.height, field.depth, wrap, topology, most, mines, generator, seed, corpus_count, &pool);
+    if (corpus_query)
+        return Corpus_query(corpus_query, field.width, field.height, field.depth, wrap, topology, most, corpus_metric, corpus_ranges[corpus_metric][0], corpus_ranges[corpus_metric][1]);
+    if (find)
+    {
+        search.width = field.width;
+        search.height = field.height;
+        search.depth = field.depth;
+        search.wrap = wrap;
+        search.topology = topology;
+        search.most = most;
+        search.mines = mines;
+        search.first_seed = seed;
+        search.generator = generator;
+        if (recover)
+            search.known = Search_load(recover, &field);
+        search.count = is_count_set ? corpus_count : (uint64_t)UINT32_MAX + 1 - seed;
+        memcpy(search.ranges, corpus_ranges, sizeof(search.ranges));
+        return Search_run(&search, &pool);
+    }
+    if (load.path)
+    {
+        load.shape = field;
+        load.rate = rate;
+        return Load_run(&load, corpus_count, &pool);
+    }
+    /* only sessions are counted */
+    if (metrics)
+        Metrics_open(metrics);
+    if (serve || idle)
+    {
+        struct Server server = {.shape = field, .mines = mines, .seed = seed, .is_seed_set = is_seed_set, .timed = timed, .generator = generator, .rate = rate};
+
+        if (idle)
+            return Server_idle(&server, is_count_set ? corpus_count : 10000);
+        return Server_run(&server, serve);
+    }
+
+    if (watch)
+        Watch_open(&spectators, watch, &field);
+
+#ifdef __OpenBSD__
+    if (metrics || watch)
+        pledge(scores ? "stdio rpath wpath cpath flock unix" : "stdio unix", NULL);
+    else
+        pledge(scores ? "stdio rpath wpath cpath flock" : "stdio", NULL);
+#endif
+
     if (show_seed)
         warnx("seed is %u", seed);
-    srandom(seed);
 
-    struct Field_Cell field_buffer[field.width * field.height];
-    field.field = field_buffer;
+    session.seed = seed;
+    session.journal = timed ? &journal : NULL;
+    session.scores = scores;
+    session.kind = (struct Scores_Kind){field.width, field.height, field.depth, mines, wrap, topology, most, 0};
+    if (!(session.name = getenv("USER")))
+        session.name = "player";
+    Game_start(&session.game, &field, mines, seed, generator);
+    if (watch)
+        Watch_set(&spectators, &field);
 
-    memset(field.field, 0, field.width * field.height);
-    selected_x = selected_y = 0;
-    field.field[0].is_selected = 1;
-    Field_generate(&field, mines);
+    Session_show(&session, stdout);
+    while ((move = Player_process(stdin)).action != Player_Move_Action_END && move.action != Player_Move_Action_ERROR)
+        Session_move(&session, move, stdout);
 
-    for (;;)
+    if (move.action == Player_Move_Action_ERROR)
+        warn("cannot read input");
+    Session_close(&session, stdout);
+    Journal_free(&journal);
+    if (watch)
+        Watch_set(&spectators, NULL);
+    Game_end(&session.game);
+    return move.action == Player_Move_Action_ERROR;
+}
+#endif
+
+#ifdef FUZZ
+/*
+ * Entry of libFuzzer, see the fuzz target of the Makefile. The first 10
+ * bytes are the field, its mines, seed and generator, every 4 bytes after
+ * them are a move: its action, then x, y and z, or if the high bit of
+ * the depth is set the rest is read as commands by Player_process. The
+ * next bit makes the field at least 64x64, so it has Field_SUM cells and
+ * its mines are counted by the kernel the topology byte selects.
+ * Fields the game refuses are made smaller or flat instead of being
+ * skipped, and the game is checked after every move. Meanwhile a
+ * spectator checks every copy of the field it gets by Field_snapshot.
+ */
+#define Fuzz_HEADER 10
+#define Fuzz_MOVE 4
+
+/* Mines near a cell counted straight from the offsets of the topology */
+unsigned Fuzz_near(const struct Field *field, unsigned x, unsigned y, unsigned z)
+{
+    const struct Field_Topology_Offsets *offsets = field->topology;
+    int width = field->width, height = field->height, depth = field->depth;
+    unsigned near = 0;
+
+    for (unsigned k = 0; k < offsets->count; ++k)
     {
-        Field_print(&field);
-        int win = Field_isWin(&field);
-        if (win > 0)
-            printf("You won! UwU\n");
-        else if (win < 0)
-            printf("You lost :<\n");
-        else
-            printf("Your current location is (%d, %d)\n", selected_x + 1, selected_y + 1);
+        int xr = x + offsets->x[offsets->parity & y][k], yr = y + offsets->y[k], zr = z + offsets->z[k];
 
-        struct Player_Move move = Player_process();
-        switch (move.action)
-        {
-        case Player_Move_Action_OPEN:
-        case Player_Move_Action_FLAG:
-        {
-            if (move.x < 0)
-            {
-                warnx("%s is %s: %d", "x", "too small", move.x + 1);
-                continue;
-            } else if (move.y < 0)
-            {
-                warnx("%s is %s: %d", "y", "too small", move.y + 1);
-                continue;
-            } else if (move.x >= field.width)
-            {
-                warnx("%s is %s: %d", "x", "too large", move.x + 1);
-                continue;
-            } else if (move.y >= field.height)
-            {
-                warnx("%s is %s: %d", "y", "too large", move.y + 1);
-                continue;
-            }
-        } break;
-        case Player_Move_Action_UP:
-        case Player_Move_Action_DOWN:
-        case Player_Move_Action_LEFT:
-        case Player_Move_Action_RIGHT:
-        {
-            field.field[selected_x + selected_y * field.width].is_selected = 0;
-        } break;
-        case Player_Move_Action_CLICK_OPEN:
-        {
-            move.x = selected_x;
-            move.y = selected_y;
-            move.action = Player_Move_Action_OPEN;
-        } break;
-        case Player_Move_Action_CLICK_FLAG:
+        if (depth == 1 && offsets->z[k])
+            continue;
+        if (field->wrap)
         {
-            move.x = selected_x;
-            move.y = selected_y;
-            move.action = Player_Move_Action_FLAG;
-        } break;
+            xr = (xr + width) % width;
+            yr = (yr + height) % height;
+            zr = (zr + depth) % depth;
         }
+        else if (xr < 0 || yr < 0 || zr < 0 || xr >= width || yr >= height || zr >= depth)
+            continue;
+        near += field->field[xr + width * (yr + height * zr)].is_mine;
+    }
+    return near;
+}
 
-        switch (move.action)
-        {
-        case Player_Move_Action_OPEN:
-        {
-            Field_open(&field, move.x, move.y);
-        } break;
-        case Player_Move_Action_FLAG:
+/* What holds for the cells between any two moves */
+void Fuzz_cells(const struct Field *field, unsigned mines)
+{
+    unsigned selected = 0, mined = 0, closed = 0, with = 0, i = 0;
+    int lost = 0, win;
+
+    for (unsigned z = 0; z < field->depth; ++z)
+    {
+        for (unsigned y = 0; y < field->height; ++y)
         {
-            switch (field.field[move.x + move.y * field.width].status)
+            for (unsigned x = 0; x < field->width; ++x, ++i)
             {
-            break; case Field_Cell_Status_HIDDEN:
-                field.field[move.x + move.y * field.width].status = Field_Cell_Status_FLAGGED;
-            break; case Field_Cell_Status_FLAGGED:
-                field.field[move.x + move.y * field.width].status = Field_Cell_Status_HIDDEN;
+                struct Field_Cell c = field->field[i];
+
+                if (c.mines_near != Fuzz_near(field, x, y, z))
+                    errx(1, "count of %u is %u, not %u", i, c.mines_near, Fuzz_near(field, x, y, z));
+                if (c.is_mine > field->most)
+                    errx(1, "cell %u has %u mines", i, c.is_mine);
+                selected += c.is_selected;
+                mined += c.is_mine;
+                with += !!c.is_mine;
+                closed += c.status != Field_Cell_Status_OPENED;
+                lost |= c.is_mine && c.status == Field_Cell_Status_OPENED;
+
+                if (c.status != Field_Cell_Status_OPENED || c.mines_near)
+                    continue;
+                const struct Field_Near *near = Field_near(field, x, y, z);
+                for (unsigned k = 0; k < near->count; ++k)
+                    if (field->field[i + near->offset[k]].status != Field_Cell_Status_OPENED)
+                        errx(1, "cell %u is opened with a closed cell near", i);
             }
-        } break;
-        case Player_Move_Action_UP:
-        {
-            if (selected_y - move.y < 0)
-                warnx("invalid location");
-            else
-                selected_y -= move.y;
-        } break;
-        case Player_Move_Action_DOWN:
-        {
-            if (selected_y + move.y >= field.height)
-                warnx("invalid location");
-            else
-                selected_y += move.y;
-        } break;
-        case Player_Move_Action_LEFT:
-        {
-            if (selected_x - move.x < 0)
-                warnx("invalid location");
-            else
-                selected_x -= move.x;
-        } break;
-        case Player_Move_Action_RIGHT:
+        }
+    }
+
+    if (selected != 1)
+        errx(1, "%u cells are selected", selected);
+    if (mined != mines)
+        errx(1, "field has %u mines, not %u", mined, mines);
+    win = Field_isWin((struct Field *)field);
+    if (win != (lost ? -1 : closed == with))
+        errx(1, "game is %d", win);
+}
+
+void Fuzz_check(const struct Game *game, unsigned mines)
+{
+    const struct Field *field = game->field;
+
+    if (game->selected_x < 0 || game->selected_x >= (int)field->width
+        || game->selected_y < 0 || game->selected_y >= (int)field->height
+        || game->selected_z < 0 || game->selected_z >= (int)field->depth)
+        errx(1, "selected cell is out of the field");
+    Fuzz_cells(field, mines);
+    if (!field->field[game->selected_x + field->width * (game->selected_y + field->height * game->selected_z)].is_selected)
+        errx(1, "selected cell is not the one of the game");
+}
+
+struct Fuzz_Spectator
+{
+    struct Field *field;
+    /* its shape with the copied cells */
+    struct Field view;
+    unsigned mines;
+    _Atomic int stop;
+};
+
+void *Fuzz_spectate(void *arg)
+{
+    struct Fuzz_Spectator *spectator = arg;
+
+    while (!atomic_load(&spectator->stop))
+    {
+        Field_snapshot(spectator->field, spectator->view.field);
+        Fuzz_cells(&spectator->view, spectator->mines);
+    }
+    return NULL;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static struct Field field;
+    static struct Fuzz_Spectator spectator;
+    struct Game game;
+    pthread_t thread;
+    enum Field_Topology topology;
+    unsigned most, mines, seed;
+    int wrap;
+
+    if (size < Fuzz_HEADER)
+        return 0;
+
+    field = (struct Field){data[0] % 16 + 1, data[1] % 16 + 1, data[2] % 4 + 1};
+    if (data[2] & 0x40)
+    {
+        field.width += 63;
+        field.height += 63;
+    }
+    topology = data[3] % Field_Topology_COUNT;
+    wrap = data[3] / Field_Topology_COUNT & 1;
+    most = data[4] % Field_MINE_MAX + 1;
+    if (field.depth > 1 && topology == Field_Topology_KNIGHT)
+        field.depth = 1;
+    if (wrap)
+    {
+        unsigned least = 2 * Field_Topology_OFFSETS[topology].reach + 1;
+
+        wrap = field.width >= least && field.height >= least && (field.depth == 1 || field.depth >= least)
+            && !(field.height % 2 && Field_Topology_OFFSETS[topology].parity);
+    }
+    Field_init(&field, wrap, topology, most);
+    while (Field_around(&field) * field.most > Field_COUNT_MAX)
+    {
+        if (field.most > 1)
+            --field.most;
+        else
+            field.depth = 1;
+        Field_init(&field, wrap, topology, field.most);
+    }
+    if (Kernel_select(data[3] / Field_Topology_COUNT / 2 % Kernel_Level_COUNT) < 0)
+        Kernel_select(Kernel_Level_GENERIC);
+
+    mines = data[5] % (Field_cells(&field) * field.most + 1);
+    memcpy(&seed, data + 6, sizeof(seed));
+    Game_start(&game, &field, mines, seed, data[4] & 0x80 ? Field_Generator_SHUFFLE : Field_Generator_RANDOM);
+    Fuzz_check(&game, mines);
+
+    spectator.field = &field;
+    spectator.view = field;
+    spectator.view.dirty = NULL;
+    spectator.mines = mines;
+    atomic_store(&spectator.stop, 0);
+    if (!(spectator.view.field = malloc(Field_cells(&field) * sizeof(*spectator.view.field))))
+        err(1, "malloc()");
+    if ((errno = pthread_create(&thread, NULL, Fuzz_spectate, &spectator)))
+        err(1, "pthread_create()");
+
+    /* the rest is read as commands of a player */
+    if (data[2] & 0x80 && size > Fuzz_HEADER)
+    {
+        struct Player_Move move;
+        FILE *input;
+
+        if (!(input = fmemopen((void *)(data + Fuzz_HEADER), size - Fuzz_HEADER, "r")))
+            err(1, "fmemopen()");
+        while ((move = Player_process(input)).action != Player_Move_Action_END)
         {
-            if (selected_x + move.x >= field.width)
-                warnx("invalid location");
-            else
-                selected_x += move.x;
-        } break;
+            if (move.action == Player_Move_Action_ERROR)
+                errx(1, "input of %zu bytes is unreadable", size - Fuzz_HEADER);
+            Game_move(&game, &move);
+            Fuzz_check(&game, mines);
         }
+        fclose(input);
+        size = Fuzz_HEADER;
+    }
 
-        switch (move.action)
+    for (size_t at = Fuzz_HEADER; at + Fuzz_MOVE <= size; at += Fuzz_MOVE)
+    {
+        struct Player_Move move = {
+            .action = data[at] % (Player_Move_Action_UP + 1),
+            .x = (signed char)data[at + 1],
+            .y = (signed char)data[at + 2],
+            .z = (signed char)data[at + 3],
+        };
+
+        /* the player gives only positive steps */
+        if (move.action != Player_Move_Action_OPEN && move.action != Player_Move_Action_FLAG)
         {
-        case Player_Move_Action_UP:
-        case Player_Move_Action_DOWN:
-        case Player_Move_Action_LEFT:
-        case Player_Move_Action_RIGHT:
-            field.field[selected_x + selected_y * field.width].is_selected = 1;
+            move.x = data[at + 1];
+            move.y = data[at + 2];
+            move.z = data[at + 3];
         }
+        Game_move(&game, &move);
+        Fuzz_check(&game, mines);
     }
+
+    atomic_store(&spectator.stop, 1);
+    pthread_join(thread, NULL);
+    free(spectator.view.field);
+    Game_end(&game);
+    return 0;
 }
+#endif